@@ -0,0 +1,54 @@
+/*
+ * Author: Pratik Mankawde
+ */
+#include <algorithm>
+#include <iostream>
+
+#include "benchmarks.h"
+
+using namespace data;
+
+namespace benchmarks {
+
+void run_approximate_query_benchmark() {
+	const std::size_t grid_size = 512;
+	const std::shared_ptr<PolygonMesh> mesh = make_grid_mesh(grid_size);
+	const std::vector<Vec3> queries = make_query_points(100000, BoundingVolume(Vec3(-64.0f, -64.0f, -32.0f),
+																				Vec3(grid_size + 64.0f, grid_size + 64.0f, 32.0f)));
+	// Warm up the r-tree cache, so that we only measure queries
+	mesh->closest_point(queries.front());
+
+	std::vector<Location> exact;
+	const double exact_ms = time_ms([&]() {
+		exact = mesh->closest_points(queries);
+	});
+
+	std::cout << "Approximate closest point queries, " << mesh->get_polygon_count() << " triangles, "
+				<< queries.size() << " queries\n"
+				<< "relative eps\ttime(ms)\tspeedup\tmax bound\tmax observed error\n"
+				<< "0\t\t" << exact_ms << "\t1\t0\t0\n";
+
+	for (const float epsilon : { 0.01f, 0.05f, 0.1f, 0.25f, 0.5f, 1.0f }) {
+		const QueryTolerance tolerance { epsilon, 0.0f };
+		std::vector<ErrorBound> bounds;
+		std::vector<Location> approximate;
+		const double approximate_ms = time_ms([&]() {
+			approximate = mesh->closest_points(queries, tolerance, &bounds);
+		});
+
+		float max_bound = 0.0f;
+		float max_error = 0.0f;
+		for (std::size_t index = 0; index < queries.size(); ++index) {
+			const float exact_distance = (mesh->get_spacial_position(exact[index]) - queries[index]).norm();
+			if (exact_distance > 0.0f) {
+				max_bound = std::max(max_bound, bounds[index].relative_error());
+				max_error = std::max(max_error, bounds[index].distance / exact_distance - 1.0f);
+			}
+		}
+		std::cout << epsilon << "\t\t" << approximate_ms << "\t" << exact_ms / approximate_ms << "\t"
+					<< max_bound << "\t" << max_error << "\n";
+	}
+	std::cout << std::endl;
+}
+
+} /* namespace benchmarks */
@@ -0,0 +1,68 @@
+/*
+ * Author: Pratik Mankawde
+ */
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <data/polygon_mesh.h>
+#include <types.h>
+
+namespace benchmarks {
+
+/**
+ * Builds a wavy grid mesh of a_grid_size x a_grid_size quads, two triangles each, spanning [0, a_grid_size] on XY plane.
+ * @param a_grid_size no. of quads along each side
+ * @return Polygon mesh
+ */
+std::shared_ptr<data::PolygonMesh> make_grid_mesh(std::size_t a_grid_size);
+
+/**
+ * Generates reproducible pseudo random query points inside a box.
+ * @param a_count no. of points
+ * @param a_bounds box to generate points in
+ * @return query points
+ */
+std::vector<Vec3> make_query_points(std::size_t a_count, const BoundingVolume& a_bounds);
+
+/**
+ * Runs a function and measures the wall time it took.
+ * @param a_function function to run
+ * @return time taken in milliseconds
+ */
+template<typename Function>
+double time_ms(Function a_function) {
+	const auto start = std::chrono::steady_clock::now();
+	a_function();
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/**
+ * Measures speed and accuracy of approximate closest point queries for a range of tolerances.
+ */
+void run_approximate_query_benchmark();
+
+/**
+ * Compares queries far from mesh on coarser grids of the same surface, to show what coarser levels could save.
+ */
+void run_far_query_benchmark();
+
+/**
+ * Compares query latencies while r-tree is rebuilt on next query and in background.
+ */
+void run_rebuild_latency_benchmark();
+
+/**
+ * Compares segment queries against sampling segments with point queries.
+ */
+void run_segment_query_benchmark();
+
+/**
+ * Measures where scanning all the triangles stops being faster than querying the r-tree.
+ */
+void run_engine_crossover_benchmark();
+
+} /* namespace benchmarks */
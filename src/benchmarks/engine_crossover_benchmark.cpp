@@ -0,0 +1,47 @@
+/*
+ * Author: Pratik Mankawde
+ */
+#include <iostream>
+#include <limits>
+
+#include "benchmarks.h"
+
+using namespace data;
+
+namespace benchmarks {
+
+void run_engine_crossover_benchmark() {
+	const std::size_t query_count = 20000;
+	std::cout << "Brute force scan vs r-tree, single threaded, " << query_count << " queries per mesh\n"
+				<< "triangles\tscan build(us)\ttree build(us)\tscan query(ns)\ttree query(ns)\n";
+
+	std::size_t crossover = 0;
+	for (const std::size_t grid_size : { 1, 2, 3, 4, 6, 8, 11, 16, 23, 32, 45, 64 }) {
+		const std::shared_ptr<PolygonMesh> mesh = make_grid_mesh(grid_size);
+		const std::vector<Vec3> queries = make_query_points(query_count, BoundingVolume(Vec3(-2.0f, -2.0f, -2.0f),
+																						Vec3(grid_size + 2.0f, grid_size + 2.0f, 2.0f)));
+		double build_us[2];
+		double query_ns[2];
+		for (const int engine : { 0, 1 }) {
+			mesh->set_brute_force_threshold(engine == 0 ? std::numeric_limits<size_t>::max() : 0);
+			// First query builds the index
+			build_us[engine] = 1000.0 * time_ms([&]() {
+				mesh->closest_point(queries.front());
+			});
+			query_ns[engine] = 1e6 * time_ms([&]() {
+				for (const Vec3& query : queries) {
+					mesh->closest_point(query);
+				}
+			}) / queries.size();
+		}
+		if (query_ns[0] <= query_ns[1]) {
+			crossover = mesh->get_polygon_count();
+		}
+		std::cout << mesh->get_polygon_count() << "\t\t" << build_us[0] << "\t\t" << build_us[1] << "\t\t"
+					<< query_ns[0] << "\t\t" << query_ns[1] << "\n";
+	}
+	std::cout << "scan is faster up to about " << crossover << " triangles, default threshold is "
+				<< PolygonMesh::DEFAULT_BRUTE_FORCE_THRESHOLD << "\n" << std::endl;
+}
+
+} /* namespace benchmarks */
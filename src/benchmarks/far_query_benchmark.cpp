@@ -0,0 +1,55 @@
+/*
+ * Author: Pratik Mankawde
+ */
+#include <iostream>
+
+#include "benchmarks.h"
+
+using namespace data;
+
+namespace benchmarks {
+
+void run_far_query_benchmark() {
+	const std::size_t grid_size = 512;
+	// Queries far away from the mesh, where many polygons are about as close as the closest one
+	const BoundingVolume far_bounds(Vec3(-256.0f, -256.0f, 128.0f), Vec3(grid_size + 256.0f, grid_size + 256.0f, 512.0f));
+	const BoundingVolume near_bounds(Vec3(0.0f, 0.0f, -2.0f), Vec3(grid_size, grid_size, 2.0f));
+	const std::vector<Vec3> far_queries = make_query_points(20000, far_bounds);
+	const std::vector<Vec3> near_queries = make_query_points(20000, near_bounds);
+
+	std::cout << "Closest point queries far from mesh, " << far_queries.size() << " queries\n"
+				<< "Coarser grids of the same surface stand in for simplified levels. Coarse-to-fine queries pay off\n"
+				<< "only if a query on a coarser level costs much less than one on the full mesh.\n"
+				<< "triangles\tqueries\trelative eps\ttime(ms)\n";
+
+	for (std::size_t level = 0; level < 3; ++level) {
+		// Each coarser grid has a quarter of the triangles, spread over the same area
+		const std::size_t level_grid_size = grid_size >> level;
+		const std::shared_ptr<PolygonMesh> mesh = make_grid_mesh(level_grid_size);
+		const float scale = static_cast<float>(grid_size) / level_grid_size;
+		std::vector<Vec3> queries = far_queries;
+		for (Vec3& query : queries) {
+			query.x() /= scale;
+			query.y() /= scale;
+		}
+		// Warm up the r-tree cache, so that we only measure queries
+		mesh->closest_point(queries.front());
+
+		for (const float epsilon : { 0.0f, 0.1f }) {
+			const QueryTolerance tolerance { epsilon, 0.0f };
+			const double far_ms = time_ms([&]() {
+				mesh->closest_points(queries, tolerance);
+			});
+			std::cout << mesh->get_polygon_count() << "\tfar\t" << epsilon << "\t\t" << far_ms << "\n";
+			if (level == 0) {
+				const double near_ms = time_ms([&]() {
+					mesh->closest_points(near_queries, tolerance);
+				});
+				std::cout << mesh->get_polygon_count() << "\tnear\t" << epsilon << "\t\t" << near_ms << "\n";
+			}
+		}
+	}
+	std::cout << std::endl;
+}
+
+} /* namespace benchmarks */
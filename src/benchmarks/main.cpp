@@ -0,0 +1,53 @@
+/*
+ * Author: Pratik Mankawde
+ */
+#include <cmath>
+#include <random>
+
+#include "benchmarks.h"
+
+namespace benchmarks {
+
+std::shared_ptr<data::PolygonMesh> make_grid_mesh(std::size_t a_grid_size) {
+	std::vector<Vec3> vertices;
+	vertices.reserve((a_grid_size + 1) * (a_grid_size + 1));
+	for (std::size_t y = 0; y <= a_grid_size; ++y) {
+		for (std::size_t x = 0; x <= a_grid_size; ++x) {
+			vertices.push_back(Vec3(x, y, std::sin(x * 0.7f) * std::cos(y * 0.3f)));
+		}
+	}
+	std::vector<data::PolygonMesh::Polygon> topology;
+	topology.reserve(a_grid_size * a_grid_size * 2);
+	for (std::size_t y = 0; y < a_grid_size; ++y) {
+		for (std::size_t x = 0; x < a_grid_size; ++x) {
+			const std::size_t corner = y * (a_grid_size + 1) + x;
+			topology.push_back(data::PolygonMesh::Polygon(corner, corner + 1, corner + a_grid_size + 2));
+			topology.push_back(data::PolygonMesh::Polygon(corner, corner + a_grid_size + 2, corner + a_grid_size + 1));
+		}
+	}
+	std::shared_ptr<data::PolygonMesh> mesh = data::PolygonMesh::create();
+	mesh->build_mesh(vertices, topology);
+	return mesh;
+}
+
+std::vector<Vec3> make_query_points(std::size_t a_count, const BoundingVolume& a_bounds) {
+	std::mt19937 generator(42);
+	std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	std::vector<Vec3> points(a_count);
+	for (Vec3& point : points) {
+		const Vec3 ratio(distribution(generator), distribution(generator), distribution(generator));
+		point = a_bounds.min() + ratio.cwiseProduct(a_bounds.sizes());
+	}
+	return points;
+}
+
+} /* namespace benchmarks */
+
+int main(int argc, char **argv) {
+	benchmarks::run_approximate_query_benchmark();
+	benchmarks::run_far_query_benchmark();
+	benchmarks::run_rebuild_latency_benchmark();
+	benchmarks::run_segment_query_benchmark();
+	benchmarks::run_engine_crossover_benchmark();
+	return 0;
+}
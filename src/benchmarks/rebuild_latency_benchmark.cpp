@@ -0,0 +1,84 @@
+/*
+ * Author: Pratik Mankawde
+ */
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+#include "benchmarks.h"
+
+using namespace data;
+
+namespace benchmarks {
+
+namespace {
+
+/**
+ * Prints median, 99th percentile and max of latencies
+ * @param a_label label of the row
+ * @param a_latencies latencies in microseconds
+ */
+void print_latencies(const char* a_label, std::vector<double>& a_latencies) {
+	std::sort(a_latencies.begin(), a_latencies.end());
+	std::cout << a_label << "\t" << a_latencies.size() << "\t" << a_latencies[a_latencies.size() / 2] << "\t"
+				<< a_latencies[a_latencies.size() * 99 / 100] << "\t" << a_latencies.back() << "\n";
+}
+
+} /* namespace */
+
+void run_rebuild_latency_benchmark() {
+	const std::size_t grid_size = 512;
+	const std::size_t rebuild_count = 4;
+	const std::shared_ptr<PolygonMesh> mesh = make_grid_mesh(grid_size);
+	const std::vector<Vec3> queries = make_query_points(100000, BoundingVolume(Vec3(0.0f, 0.0f, -8.0f),
+																				Vec3(grid_size, grid_size, 8.0f)));
+	// Every edit rebuilds the whole r-tree, be it on next query or in background
+	mesh->set_rebuild_ratio(0.0f);
+	auto edit_mesh = [&](std::size_t a_rebuild) {
+		const Vec3 corner(a_rebuild, 0.0f, 16.0f);
+		mesh->add_polygons({ corner, corner + Vec3::UnitX(), corner + Vec3::UnitY() },
+							{ PolygonMesh::Polygon(mesh->get_vertex_count(), mesh->get_vertex_count() + 1, mesh->get_vertex_count() + 2) });
+	};
+	mesh->closest_point(queries.front());
+
+	std::cout << "Query latency while r-tree is rebuilt " << rebuild_count << " times, " << mesh->get_polygon_count()
+				<< " triangles\n"
+				<< "mode\t\tqueries\tp50(us)\tp99(us)\tmax(us)\n";
+
+	// Rebuild on next query: the query right after an edit waits for the whole rebuild
+	std::vector<double> latencies;
+	std::size_t query_index = 0;
+	for (std::size_t rebuild = 0; rebuild < rebuild_count; ++rebuild) {
+		edit_mesh(rebuild);
+		for (std::size_t count = 0; count < 2000; ++count, ++query_index) {
+			latencies.push_back(1000.0 * time_ms([&]() {
+				mesh->closest_point(queries[query_index % queries.size()]);
+			}));
+		}
+	}
+	print_latencies("on query", latencies);
+
+	// Rebuild in background: a reader thread keeps querying the last published r-tree
+	mesh->set_background_rebuild(true);
+	latencies.clear();
+	std::atomic<bool> is_done(false);
+	std::thread reader([&]() {
+		for (std::size_t index = 0; !is_done; ++index) {
+			latencies.push_back(1000.0 * time_ms([&]() {
+				mesh->closest_point(queries[index % queries.size()]);
+			}));
+		}
+	});
+	for (std::size_t rebuild = 0; rebuild < rebuild_count; ++rebuild) {
+		edit_mesh(rebuild_count + rebuild);
+		mesh->wait_for_spacial_index();
+	}
+	is_done = true;
+	reader.join();
+	mesh->set_background_rebuild(false);
+	print_latencies("background", latencies);
+	std::cout << std::endl;
+}
+
+} /* namespace benchmarks */
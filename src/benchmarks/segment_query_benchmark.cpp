@@ -0,0 +1,62 @@
+/*
+ * Author: Pratik Mankawde
+ */
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "benchmarks.h"
+
+using namespace data;
+
+namespace benchmarks {
+
+void run_segment_query_benchmark() {
+	const std::size_t grid_size = 512;
+	const std::size_t sample_count = 32;
+	const std::shared_ptr<PolygonMesh> mesh = make_grid_mesh(grid_size);
+	const std::vector<Vec3> starts = make_query_points(20000, BoundingVolume(Vec3(0.0f, 0.0f, -4.0f),
+																			Vec3(grid_size, grid_size, 4.0f)));
+	const std::vector<Vec3> offsets = make_query_points(starts.size(), BoundingVolume(Vec3(-8.0f, -8.0f, -2.0f),
+																					Vec3(8.0f, 8.0f, 2.0f)));
+	std::vector<Capsule> capsules;
+	std::vector<Vec3> samples;
+	for (std::size_t index = 0; index < starts.size(); ++index) {
+		capsules.push_back(Capsule { starts[index], starts[index] + offsets[index], 0.0f });
+		for (std::size_t sample = 0; sample < sample_count; ++sample) {
+			samples.push_back(starts[index] + offsets[index] * (sample / (sample_count - 1.0f)));
+		}
+	}
+	// Warm up the caches, so that we only measure queries
+	mesh->closest_point(samples.front());
+	mesh->closest_point(capsules.front());
+
+	std::vector<SegmentLocation> segment_locations;
+	const double segment_ms = time_ms([&]() {
+		segment_locations = mesh->closest_points(capsules);
+	});
+	std::vector<Location> sample_locations;
+	const double sample_ms = time_ms([&]() {
+		sample_locations = mesh->closest_points(samples);
+	});
+
+	// Sampling never finds a closer point than the segment query, only misses some
+	float max_sampling_error = 0.0f;
+	for (std::size_t index = 0; index < capsules.size(); ++index) {
+		float sampled_distance = std::numeric_limits<float>::max();
+		for (std::size_t sample = 0; sample < sample_count; ++sample) {
+			const std::size_t sample_index = index * sample_count + sample;
+			sampled_distance = std::min(sampled_distance,
+										(mesh->get_spacial_position(sample_locations[sample_index]) - samples[sample_index]).norm());
+		}
+		max_sampling_error = std::max(max_sampling_error, sampled_distance - segment_locations[index].distance);
+	}
+
+	std::cout << "Segment queries, " << mesh->get_polygon_count() << " triangles, " << capsules.size() << " segments\n"
+				<< "method\t\t\ttime(ms)\tmax distance error\n"
+				<< "segment query\t\t" << segment_ms << "\t0\n"
+				<< sample_count << " point queries\t" << sample_ms << "\t" << max_sampling_error << "\n"
+				<< std::endl;
+}
+
+} /* namespace benchmarks */
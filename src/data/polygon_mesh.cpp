@@ -1,9 +1,15 @@
 /*
  * Author: Pratik Mankawde
  */
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <queue>
 #include <boost/geometry.hpp>
 #include <boost/geometry/algorithms/detail/envelope/interface.hpp>
+#include <tbb/blocked_range.h>
 #include <tbb/parallel_for.h>
 
 #include <data/polygon_mesh.h>
@@ -25,107 +31,923 @@ bool PolygonMesh::build_mesh(const std::vector<Vec3>& a_vertex_locations, const
 
 	m_vertices = a_vertex_locations;
 	m_topology = a_topology;
+	m_polygon_masks.assign(m_topology.size(), ALL_POLYGONS_MASK);
+	// Attributes of old mesh make no sense for the new one
+	m_attributes.clear();
+	increment_version();
+	if (m_is_background_rebuild) {
+		// Queries keep using the old index until the new one is ready
+		m_spacial_query_cache->rebuild_async(shared_from_this());
+	} else {
+		// Old indices are of no use anymore, free them right away instead of waiting for the next query
+		m_spacial_query_cache->invalidate();
+	}
+	m_hierarchy_cache->invalidate();
+	return true;
+}
+
+bool PolygonMesh::set_polygon_masks(const std::vector<PolygonMask>& a_polygon_masks) {
+	if (a_polygon_masks.size() != m_topology.size()) {
+		return false;
+	}
+	m_polygon_masks = a_polygon_masks;
+	// Masks do not change the shape of mesh, so the hierarchy only needs the masks on its nodes updated
+	const std::unique_ptr<HierarchyCacheData>& hierarchy = m_hierarchy_cache->get_current_data();
+	if (m_hierarchy_cache->is_valid(*this)) {
+		hierarchy->update_masks(*this);
+	}
+	return true;
+}
+
+bool PolygonMesh::add_polygons(const std::vector<Vec3>& a_vertex_locations, const std::vector<Polygon>& a_topology) {
+	const size_t vertex_count = m_vertices.size() + a_vertex_locations.size();
+	for (const Polygon& polygon : a_topology) {
+		if (polygon.maxCoeff() >= vertex_count) {
+			return false;
+		}
+	}
+	if (a_topology.empty() && a_vertex_locations.empty()) {
+		return true;
+	}
+
+	SpacialQueryCacheData* spacial_index = get_spacial_index_for_edit(a_topology.size());
+	const size_t first_index = m_topology.size();
+	m_vertices.insert(m_vertices.end(), a_vertex_locations.begin(), a_vertex_locations.end());
+	m_topology.insert(m_topology.end(), a_topology.begin(), a_topology.end());
+	m_polygon_masks.resize(m_topology.size(), ALL_POLYGONS_MASK);
+	for (const auto& attribute : m_attributes) {
+		attribute.second->resize(get_element_count(attribute.second->get_domain()));
+	}
+	increment_version();
+
+	if (spacial_index != nullptr) {
+		for (size_t index = first_index; index < m_topology.size(); ++index) {
+			spacial_index->insert(*this, index);
+		}
+		spacial_index->set_data_version(get_version());
+	} else if (m_is_background_rebuild) {
+		m_spacial_query_cache->rebuild_async(shared_from_this());
+	}
 	return true;
 }
 
-Location PolygonMesh::closest_point(const Vec3& a_query_point) const {
+bool PolygonMesh::remove_polygons(const std::vector<size_t>& a_polygon_indices) {
+	// We remove polygons from the highest index to lowest, so that the last polygon,
+	// which is moved into the slot of removed one, is never one that is yet to be removed.
+	std::vector<size_t> polygon_indices = a_polygon_indices;
+	std::sort(polygon_indices.begin(), polygon_indices.end(), std::greater<size_t>());
+	polygon_indices.erase(std::unique(polygon_indices.begin(), polygon_indices.end()), polygon_indices.end());
+	if (polygon_indices.empty()) {
+		return true;
+	}
+	if (polygon_indices.front() >= m_topology.size()) {
+		return false;
+	}
+
+	// Moving a polygon costs us a removal and an insertion
+	SpacialQueryCacheData* spacial_index = get_spacial_index_for_edit(polygon_indices.size() * 3);
+	for (const size_t polygon_index : polygon_indices) {
+		const size_t last_index = m_topology.size() - 1;
+		if (spacial_index != nullptr) {
+			spacial_index->remove(polygon_index);
+			if (polygon_index != last_index) {
+				spacial_index->remove(last_index);
+			}
+		}
+		m_topology[polygon_index] = m_topology[last_index];
+		m_topology.pop_back();
+		m_polygon_masks[polygon_index] = m_polygon_masks[last_index];
+		m_polygon_masks.pop_back();
+		for (const auto& attribute : m_attributes) {
+			if (attribute.second->get_domain() == AttributeDomain::FACE) {
+				attribute.second->swap_remove(polygon_index);
+			}
+		}
+		if (spacial_index != nullptr && polygon_index != last_index) {
+			spacial_index->insert(*this, polygon_index);
+		}
+	}
+	increment_version();
+
+	if (spacial_index != nullptr) {
+		spacial_index->set_data_version(get_version());
+	} else if (m_is_background_rebuild) {
+		m_spacial_query_cache->rebuild_async(shared_from_this());
+	}
+	return true;
+}
+
+PolygonMesh::SpacialQueryCacheData* PolygonMesh::get_spacial_index_for_edit(size_t a_edit_count) {
+	// Published index may be in use by queries running in background rebuild mode
+	if (m_is_background_rebuild || !m_spacial_query_cache->is_valid(*this)) {
+		return nullptr;
+	}
+	SpacialQueryCacheData* spacial_index = m_spacial_query_cache->get_mutable_data();
+	const float edit_limit = m_rebuild_ratio * spacial_index->get_built_polygon_count();
+	// Packing polygons of a small mesh again costs next to nothing
+	if (spacial_index->is_brute_force() || spacial_index->get_edit_count() + a_edit_count > edit_limit) {
+		m_spacial_query_cache->invalidate();
+		return nullptr;
+	}
+	return spacial_index;
+}
+
+const PolygonMesh::SpacialQueryCacheData* PolygonMesh::get_spacial_index(
+		std::shared_ptr<const SpacialQueryCacheData>& a_snapshot) const {
+	if (m_is_background_rebuild) {
+		// We hold on to the snapshot till caller is done, even if a newer one gets published meanwhile.
+		// Mesh may be changing, so we never fall back to building the index from it here.
+		a_snapshot = m_spacial_query_cache->get_snapshot();
+		return a_snapshot.get();
+	}
+	return m_spacial_query_cache->get_cached_data(shared_from_this()).get();
+}
+
+BoundingVolume PolygonMesh::get_polygon_bounds(size_t index) const {
+	const Polygon& vertex_indices = m_topology[index];
+	BoundingVolume bounding_volume;
+	// In case we have non-triangle based mesh, we will iterate over the vertex points and
+	// expand our bounding volume with each of them
+	bounding_volume.extend(m_vertices[vertex_indices[0]]);
+	bounding_volume.extend(m_vertices[vertex_indices[1]]);
+	bounding_volume.extend(m_vertices[vertex_indices[2]]);
+	return bounding_volume;
+}
+
+Location PolygonMesh::closest_point(const Vec3& a_query_point,
+									const QueryTolerance& a_tolerance,
+									ErrorBound* a_error_bound,
+									Vec3* a_closest_position) const {
+	// Mesh is not looked at here, as it may be changing in background rebuild mode.
+	// Spacial index of a mesh without polygons finds nothing.
+	std::shared_ptr<const SpacialQueryCacheData> snapshot;
+	const SpacialQueryCacheData* spacial_index = get_spacial_index(snapshot);
+	if (spacial_index == nullptr) {
+		return INVALID_LOCATION;
+	}
+	ErrorBound error_bound;
+	const Location location = search_polygon_tree(*spacial_index, a_query_point, a_tolerance, error_bound, a_closest_position);
+	if (a_error_bound != nullptr) {
+		*a_error_bound = error_bound;
+	}
+	return location;
+}
+
+Location PolygonMesh::search_polygon_tree(const SpacialQueryCacheData& a_spacial_index,
+											const Vec3& a_query_point,
+											const QueryTolerance& a_tolerance,
+											ErrorBound& a_error_bound,
+											Vec3* a_closest_position) const {
 
 	/** Steps followed to calculate closest point:
 	 *
 	 * - Initialize r-tree data structure if not initialized already
-	 * - query the polygons closest to the query point
+	 * - query the polygons closest to the query point, sorted by distance of their bounding volumes
 	 * - Check each one of them for the closest projected point on them.
+	 * - Stop once the next bounding volume is farther than the closest point found (minus the tolerance)
+	 * - If we ran out of polygons before that, query again for twice as many polygons
 	 * - Return the closest point as spacial location or return invalid location if not found.
 	 */
 
-	if (m_vertices.size() < 3) {
-		return INVALID_LOCATION;
+	if (a_spacial_index.is_brute_force()) {
+		// Scan is exact, and cheaper than checking when to stop
+		float distance = std::numeric_limits<float>::max();
+		const Location location = a_spacial_index.scan_closest_point(a_query_point, distance);
+		if (a_closest_position != nullptr) {
+			*a_closest_position = a_spacial_index.get_position(location);
+		}
+		if (!location.is_valid) {
+			a_error_bound = ErrorBound { std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+			return INVALID_LOCATION;
+		}
+		a_error_bound = ErrorBound { distance, distance };
+		return location;
 	}
+	const std::unique_ptr<SpacialQueryCacheData::SpacialCachePolygonTree>& tree = a_spacial_index.get_polygon_tree();
+
+	Location projected_location = INVALID_LOCATION;
+	float min_distance = std::numeric_limits<float>::max();
+	// Lower bound on the distance of polygons not visited yet
+	float lower_bound = 0.0f;
+
+	auto is_close_enough = [&](float a_lower_bound) {
+		return min_distance <= a_lower_bound
+				|| min_distance <= (1.0f + a_tolerance.relative_epsilon) * a_lower_bound
+				|| min_distance - a_lower_bound <= a_tolerance.absolute_epsilon;
+	};
 
+	// Squared distance of bounding volume and polygon index
+	std::vector<std::pair<float, size_t>> candidates;
 	std::vector<PolygonIndexPair> nearest_polygons;
 	nearest_polygons.reserve(CLOSEST_TRIANGLE_COUNT);
+	bool is_done = false;
+	// Squared distance of the farthest bounding volume visited, kept as r-tree gave it. Squaring lower_bound
+	// again could round above it, and skip unvisited bounding volumes tied with the last visited one.
+	float visited_distance = 0.0f;
 
-	const std::unique_ptr<SpacialQueryCacheData>& cached_data =
-			m_spacial_query_cache->get_cached_data(shared_from_this());
-	const std::unique_ptr<SpacialQueryCacheData::SpacialCachePolygonTree>& tree = cached_data->get_polygon_tree();
+	for (size_t candidate_count = CLOSEST_TRIANGLE_COUNT; !is_done; candidate_count *= 2) {
+		// Incremental nearest queries of boost r-tree are slow when asked for a large no. of values,
+		// so instead we query again for more polygons. Bounding volumes closer than the farthest one of
+		// previous query have been visited already.
+		nearest_polygons.clear();
+		tree->query(nearest(a_query_point, static_cast<unsigned>(candidate_count)), std::back_inserter(nearest_polygons));
 
-	// We query for 16 polygons closest to our query point and then we check each of them individually
-	tree->query(nearest(a_query_point, CLOSEST_TRIANGLE_COUNT), std::back_inserter(nearest_polygons));
+		candidates.clear();
+		for (const PolygonIndexPair& polygon_index_pair : nearest_polygons) {
+			// comparable_distance gives squared distance for cartesian points
+			const float distance = comparable_distance(a_query_point, polygon_index_pair.first);
+			if (distance >= visited_distance) {
+				candidates.emplace_back(distance, polygon_index_pair.second);
+			}
+		}
+		std::sort(candidates.begin(), candidates.end());
 
-	Location projected_location = INVALID_LOCATION;
-	std::vector<float> squared_distances;
-	squared_distances.resize(CLOSEST_TRIANGLE_COUNT);
-
-	std::vector<Vec3> barycentric_coords_vec;
-	barycentric_coords_vec.resize(CLOSEST_TRIANGLE_COUNT);
-
-	tbb::parallel_for(std::size_t { 0 }, CLOSEST_TRIANGLE_COUNT, [&](std::size_t index) {
-		PolygonIndexPair& polygon_index_pair = nearest_polygons[index];
-		const Polygon& polygon = m_topology[polygon_index_pair.second];
-		const Vec3& vertex1 = m_vertices[polygon[0]];
-		const Vec3& vertex2 = m_vertices[polygon[1]];
-		const Vec3& vertex3 = m_vertices[polygon[2]];
-
-		// Our barycentric calculation is based on an assumption that the polygon is a triangle
-		// if it's not we will triangulate it here by triangle-fan technique and evaluate each triangle.
-		const Vec3 barycentric_coords = data::get_closest_point_on_triangle(vertex1, vertex2, vertex3, a_query_point);
-		const Vec3 projected_point = Vec3(vertex1 * barycentric_coords.x()
-				+ vertex2 * barycentric_coords.y()
-				+ vertex3 * barycentric_coords.z());
-		squared_distances[index] = (projected_point - a_query_point).squaredNorm();
-		barycentric_coords_vec[index] = barycentric_coords;
-	});
+		for (const std::pair<float, size_t>& candidate : candidates) {
+			lower_bound = std::sqrt(candidate.first);
+			if (is_close_enough(lower_bound)) {
+				is_done = true;
+				break;
+			}
+			visited_distance = candidate.first;
 
-	size_t closest_location_index = 0;
-	float min_distance = std::numeric_limits<float>::max();
-	for (size_t index = 0; index < CLOSEST_TRIANGLE_COUNT; ++index) {
-		if (squared_distances[index] < min_distance) {
-			min_distance = squared_distances[index];
-			closest_location_index = index;
+			float distance = 0.0f;
+			const Location location = a_spacial_index.get_closest_point_on_polygon(candidate.second, a_query_point, distance);
+			if (distance < min_distance) {
+				min_distance = distance;
+				projected_location = location;
+			}
 		}
+
+		if (nearest_polygons.size() < candidate_count) {
+			// We have visited every polygon there is
+			lower_bound = min_distance;
+			is_done = true;
+		} else if (!is_done) {
+			is_done = is_close_enough(lower_bound);
+		}
+	}
+
+	a_error_bound.distance = min_distance;
+	a_error_bound.lower_bound = std::min(lower_bound, min_distance);
+	if (a_closest_position != nullptr) {
+		*a_closest_position = a_spacial_index.get_position(projected_location);
+	}
+	return projected_location;
+}
+
+std::vector<Location> PolygonMesh::closest_points(const std::vector<Vec3>& a_query_points,
+													const QueryTolerance& a_tolerance,
+													std::vector<ErrorBound>* a_error_bounds,
+													std::vector<Vec3>* a_closest_positions) const {
+	std::vector<Location> locations(a_query_points.size(), INVALID_LOCATION);
+	if (a_error_bounds != nullptr) {
+		a_error_bounds->resize(a_query_points.size());
+	}
+	if (a_closest_positions != nullptr) {
+		a_closest_positions->assign(a_query_points.size(), Vec3::Zero());
+	}
+	if (a_query_points.empty()) {
+		return locations;
 	}
 
-	projected_location.barycentric_coords = barycentric_coords_vec[closest_location_index];
-	PolygonIndexPair& polygon_index_pair = nearest_polygons[closest_location_index];
-	projected_location.polygon_index = polygon_index_pair.second;
-	projected_location.vertex_indices = m_topology[polygon_index_pair.second];
-	projected_location.is_valid = true;
+	// Spacial index is looked up once for the whole batch, before we fan out
+	std::shared_ptr<const SpacialQueryCacheData> snapshot;
+	const SpacialQueryCacheData* spacial_index = get_spacial_index(snapshot);
+	if (spacial_index == nullptr) {
+		return locations;
+	}
+
+	tbb::parallel_for(std::size_t { 0 }, a_query_points.size(), [&](std::size_t index) {
+		ErrorBound error_bound;
+		locations[index] = search_polygon_tree(*spacial_index,
+												a_query_points[index],
+												a_tolerance,
+												error_bound,
+												a_closest_positions != nullptr ? &(*a_closest_positions)[index] : nullptr);
+		if (a_error_bounds != nullptr) {
+			(*a_error_bounds)[index] = error_bound;
+		}
+	});
+	return locations;
+}
+
+Location PolygonMesh::closest_point(const Vec3& a_query_point,
+									PolygonMask a_filter_mask,
+									const QueryTolerance& a_tolerance,
+									ErrorBound* a_error_bound) const {
+	if (m_vertices.size() < 3) {
+		return INVALID_LOCATION;
+	}
+	return search_hierarchy(*m_hierarchy_cache->get_cached_data(shared_from_this()),
+							a_query_point,
+							a_filter_mask,
+							a_tolerance,
+							a_error_bound);
+}
 
+Location PolygonMesh::search_hierarchy(const HierarchyCacheData& a_hierarchy,
+										const Vec3& a_query_point,
+										PolygonMask a_filter_mask,
+										const QueryTolerance& a_tolerance,
+										ErrorBound* a_error_bound) const {
+	Location projected_location = INVALID_LOCATION;
+	float min_distance = std::numeric_limits<float>::max();
+
+	const float lower_bound = a_hierarchy.traverse(a_filter_mask,
+		[&](const BoundingVolume& a_bounds) {
+			return std::sqrt(a_bounds.squaredExteriorDistance(a_query_point));
+		},
+		[&](float a_lower_bound) {
+			return min_distance <= a_lower_bound
+					|| min_distance <= (1.0f + a_tolerance.relative_epsilon) * a_lower_bound
+					|| min_distance - a_lower_bound <= a_tolerance.absolute_epsilon;
+		},
+		[&](size_t a_polygon_index) {
+			float distance = 0.0f;
+			const Location location = get_closest_point_on_polygon(a_polygon_index, a_query_point, distance);
+			if (distance < min_distance) {
+				min_distance = distance;
+				projected_location = location;
+			}
+		});
+
+	if (a_error_bound != nullptr) {
+		a_error_bound->distance = min_distance;
+		a_error_bound->lower_bound = std::min(lower_bound, min_distance);
+	}
 	return projected_location;
 }
 
+std::vector<Location> PolygonMesh::closest_points(const std::vector<Vec3>& a_query_points,
+													PolygonMask a_filter_mask,
+													const QueryTolerance& a_tolerance,
+													std::vector<ErrorBound>* a_error_bounds) const {
+	std::vector<Location> locations(a_query_points.size(), INVALID_LOCATION);
+	if (a_error_bounds != nullptr) {
+		a_error_bounds->resize(a_query_points.size());
+	}
+	if (m_vertices.size() < 3 || a_query_points.empty()) {
+		return locations;
+	}
+
+	// Hierarchy is looked up once for the whole batch
+	const HierarchyCacheData& hierarchy = *m_hierarchy_cache->get_cached_data(shared_from_this());
+
+	tbb::parallel_for(std::size_t { 0 }, a_query_points.size(), [&](std::size_t index) {
+		locations[index] = search_hierarchy(hierarchy,
+											a_query_points[index],
+											a_filter_mask,
+											a_tolerance,
+											a_error_bounds != nullptr ? &(*a_error_bounds)[index] : nullptr);
+	});
+	return locations;
+}
+
+SegmentLocation PolygonMesh::closest_point(const Capsule& a_capsule, PolygonMask a_filter_mask) const {
+	if (m_vertices.size() < 3) {
+		return INVALID_SEGMENT_LOCATION;
+	}
+	return search_hierarchy(*m_hierarchy_cache->get_cached_data(shared_from_this()), a_capsule, a_filter_mask);
+}
+
+SegmentLocation PolygonMesh::search_hierarchy(const HierarchyCacheData& a_hierarchy,
+												const Capsule& a_capsule,
+												PolygonMask a_filter_mask) const {
+	SegmentLocation closest = INVALID_SEGMENT_LOCATION;
+	// We work with squared distances to segment, radius does not change which polygon is the closest
+	float min_squared_distance = std::numeric_limits<float>::max();
+	a_hierarchy.traverse(a_filter_mask,
+		[&](const BoundingVolume& a_bounds) {
+			return get_squared_distance_segment_box(a_capsule.start, a_capsule.end, a_bounds);
+		},
+		[&](float a_lower_bound) {
+			return min_squared_distance <= a_lower_bound;
+		},
+		[&](size_t a_polygon_index) {
+			const Polygon& polygon = m_topology[a_polygon_index];
+			float parameter = 0.0f;
+			Vec3 barycentric_coords;
+			const float squared_distance = get_closest_points_on_segment_triangle(a_capsule.start,
+																					a_capsule.end,
+																					m_vertices[polygon[0]],
+																					m_vertices[polygon[1]],
+																					m_vertices[polygon[2]],
+																					parameter,
+																					barycentric_coords);
+			if (squared_distance < min_squared_distance) {
+				min_squared_distance = squared_distance;
+				closest.location = Location { polygon, a_polygon_index, barycentric_coords, true };
+				closest.parameter = parameter;
+			}
+		});
+
+	if (closest.location.is_valid) {
+		closest.distance = std::sqrt(min_squared_distance) - a_capsule.radius;
+	}
+	return closest;
+}
+
+std::vector<SegmentLocation> PolygonMesh::closest_points(const std::vector<Capsule>& a_capsules,
+															PolygonMask a_filter_mask) const {
+	std::vector<SegmentLocation> locations(a_capsules.size(), INVALID_SEGMENT_LOCATION);
+	if (m_vertices.size() < 3 || a_capsules.empty()) {
+		return locations;
+	}
+
+	// Hierarchy is looked up once for the whole batch
+	const HierarchyCacheData& hierarchy = *m_hierarchy_cache->get_cached_data(shared_from_this());
+
+	tbb::parallel_for(std::size_t { 0 }, a_capsules.size(), [&](std::size_t index) {
+		locations[index] = search_hierarchy(hierarchy, a_capsules[index], a_filter_mask);
+	});
+	return locations;
+}
+
+Location PolygonMesh::get_closest_point_on_polygon(size_t a_polygon_index, const Vec3& a_query_point, float& a_distance) const {
+	const Polygon& polygon = m_topology[a_polygon_index];
+	const Vec3& vertex1 = m_vertices[polygon[0]];
+	const Vec3& vertex2 = m_vertices[polygon[1]];
+	const Vec3& vertex3 = m_vertices[polygon[2]];
+
+	// Our barycentric calculation is based on an assumption that the polygon is a triangle
+	// if it's not we will triangulate it here by triangle-fan technique and evaluate each triangle.
+	const Vec3 barycentric_coords = data::get_closest_point_on_triangle(vertex1, vertex2, vertex3, a_query_point);
+	const Vec3 projected_point = Vec3(vertex1 * barycentric_coords.x()
+			+ vertex2 * barycentric_coords.y()
+			+ vertex3 * barycentric_coords.z());
+	a_distance = (projected_point - a_query_point).norm();
+	return Location { polygon, a_polygon_index, barycentric_coords, true };
+}
+
 Vec3 PolygonMesh::get_spacial_position(const Location& spacial_location) const {
-	if (!spacial_location.is_valid) {
-		return Vec3();
+	if (!spacial_location.is_valid || spacial_location.vertex_indices.maxCoeff() >= m_vertices.size()) {
+		return Vec3::Zero();
 	}
 	return spacial_location.barycentric_coords.x() * m_vertices[spacial_location.vertex_indices[0]]
 			+ spacial_location.barycentric_coords.y() * m_vertices[spacial_location.vertex_indices[1]]
 			+ spacial_location.barycentric_coords.z() * m_vertices[spacial_location.vertex_indices[2]];
 }
 
+bool PolygonMesh::evaluate(const std::vector<Location>& a_locations, const EvaluationBuffers& a_buffers) const {
+	std::vector<const AttributeChannelBase*> channels;
+	for (const AttributeOutput& output : a_buffers.attributes) {
+		const AttributeChannelBase* channel = get_attribute(output.name);
+		if (channel == nullptr || channel->get_component_count() != output.components.size()) {
+			return false;
+		}
+		channels.push_back(channel);
+	}
+	const AttributeChannel<Vec3>* normals = get_attribute<Vec3>(NORMAL_ATTRIBUTE);
+	if (normals != nullptr && normals->get_domain() != AttributeDomain::VERTEX) {
+		normals = nullptr;
+	}
+	const bool needs_positions = a_buffers.positions[0] != nullptr
+									|| a_buffers.positions[1] != nullptr
+									|| a_buffers.positions[2] != nullptr;
+	const bool needs_normals = a_buffers.normals[0] != nullptr
+									|| a_buffers.normals[1] != nullptr
+									|| a_buffers.normals[2] != nullptr;
+
+	if (m_vertices.empty()) {
+		// Nothing to evaluate on, every location is invalid
+		auto clear = [&a_locations](float* a_output) {
+			if (a_output != nullptr) {
+				std::fill(a_output, a_output + a_locations.size(), 0.0f);
+			}
+		};
+		for (int component = 0; component < 3; ++component) {
+			clear(a_buffers.positions[component]);
+			clear(a_buffers.normals[component]);
+		}
+		for (const AttributeOutput& output : a_buffers.attributes) {
+			std::for_each(output.components.begin(), output.components.end(), clear);
+		}
+		return true;
+	}
+
+	// Locations are unpacked a block at a time, and everything is then evaluated one output array at a time
+	const size_t block_size = 1024;
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, a_locations.size(), block_size), [&](const tbb::blocked_range<size_t>& range) {
+		const size_t begin = range.begin();
+		LocationBlock block;
+		block.assign(&a_locations[begin], range.size(), m_vertices.size(), m_topology.size());
+
+		auto offset = [begin](const std::array<float*, 3>& a_outputs) {
+			return std::array<float*, 3> {{ a_outputs[0] != nullptr ? a_outputs[0] + begin : nullptr,
+											a_outputs[1] != nullptr ? a_outputs[1] + begin : nullptr,
+											a_outputs[2] != nullptr ? a_outputs[2] + begin : nullptr }};
+		};
+		if (needs_positions) {
+			interpolate_vertex_values(m_vertices, block, offset(a_buffers.positions).data());
+		}
+
+		if (needs_normals) {
+			// All the components are needed for normalizing, even if caller does not want some of them
+			std::array<std::vector<float>, 3> normal;
+			for (std::vector<float>& component : normal) {
+				component.resize(block.count);
+			}
+			const std::array<float*, 3> normal_outputs {{ normal[0].data(), normal[1].data(), normal[2].data() }};
+			if (normals != nullptr) {
+				interpolate_vertex_values(normals->get_values(), block, normal_outputs.data());
+			} else {
+				for (size_t index = 0; index < block.count; ++index) {
+					const Vec3& vertex1 = m_vertices[block.vertex_indices[0][index]];
+					const Vec3 polygon_normal = block.validity[index]
+							* (m_vertices[block.vertex_indices[1][index]] - vertex1).cross(m_vertices[block.vertex_indices[2][index]] - vertex1);
+					normal[0][index] = polygon_normal.x();
+					normal[1][index] = polygon_normal.y();
+					normal[2][index] = polygon_normal.z();
+				}
+			}
+			const std::array<float*, 3> outputs = offset(a_buffers.normals);
+			for (size_t index = 0; index < block.count; ++index) {
+				const float length = std::sqrt(normal[0][index] * normal[0][index]
+												+ normal[1][index] * normal[1][index]
+												+ normal[2][index] * normal[2][index]);
+				// Zero normals, of invalid locations or polygons without area, stay zero
+				const float scale = length > 0.0f ? 1.0f / length : 0.0f;
+				for (int component = 0; component < 3; ++component) {
+					normal[component][index] *= scale;
+				}
+			}
+			for (int component = 0; component < 3; ++component) {
+				if (outputs[component] != nullptr) {
+					std::copy(normal[component].begin(), normal[component].end(), outputs[component]);
+				}
+			}
+		}
+
+		std::vector<float*> outputs;
+		for (size_t channel_index = 0; channel_index < channels.size(); ++channel_index) {
+			outputs.clear();
+			for (float* component : a_buffers.attributes[channel_index].components) {
+				// Null arrays are skipped, so they must stay null
+				outputs.push_back(component != nullptr ? component + begin : nullptr);
+			}
+			channels[channel_index]->interpolate(block, outputs.data());
+		}
+	});
+	return true;
+}
+
+PolygonMesh::SpacialQueryCacheData::SpacialQueryCacheData(std::shared_ptr<const Data> a_data)
+		: 	CacheData(nullptr),
+			m_is_brute_force(false),
+			m_polygon_tree(nullptr),
+			m_built_polygon_count(0),
+			m_edit_count(0) {
+	// Mesh owns this cache, holding on to it here would keep the mesh alive forever
+	set_data_version(a_data->get_version());
+	const PolygonMesh* polymesh_data = dynamic_cast<const PolygonMesh*>(a_data.get());
+	m_polygons = polymesh_data->m_topology;
+	m_is_brute_force = m_polygons.size() <= polymesh_data->m_brute_force_threshold;
+	m_corners.resize(m_polygons.size() * 3);
+	for (size_t index = 0; index < m_polygons.size(); ++index) {
+		for (int corner = 0; corner < 3; ++corner) {
+			m_corners[index * 3 + corner] = polymesh_data->m_vertices[m_polygons[index][corner]];
+		}
+	}
+}
+
 void PolygonMesh::SpacialQueryCacheData::compute() {
 
 	if (static_cast<bool>(m_polygon_tree)) {
 		m_polygon_tree->clear();
 	}
+	m_built_polygon_count = m_polygons.size();
+	m_edit_count = 0;
+	if (m_is_brute_force) {
+		pack_polygons();
+		return;
+	}
+	// Mesh may be changing while we are here, so we only look at the copy of polygons
 	std::vector<PolygonIndexPair> poly_index_pair;
-	const std::shared_ptr<const PolygonMesh> polymesh_data = std::dynamic_pointer_cast<const PolygonMesh>(m_data);
-	poly_index_pair.resize(polymesh_data->get_polygon_count());
+	poly_index_pair.resize(m_polygons.size());
 
-	tbb::parallel_for(std::size_t { 0 }, polymesh_data->get_polygon_count(), [&](std::size_t index) {
-		const Polygon& vertex_indices = polymesh_data->get_polygon_at(index);
-		BoundingVolume bounding_volume;
+	tbb::parallel_for(std::size_t { 0 }, m_polygons.size(), [&](std::size_t index) {
 		// We create a bounding volume for the polygon
-		// In case we have non-triangle based mesh, we will iterate over the vertex points and
-		// expand our bounding volume with each of them
-		bounding_volume.extend(polymesh_data->get_vertex_at(vertex_indices[0]));
-		bounding_volume.extend(polymesh_data->get_vertex_at(vertex_indices[1]));
-		bounding_volume.extend(polymesh_data->get_vertex_at(vertex_indices[2]));
-		poly_index_pair[index] = std::make_pair(bounding_volume, index);
+		poly_index_pair[index] = std::make_pair(get_polygon_bounds(index), index);
 	});
 	// We initialize r-tree with all the data at once. This will initialize tree with packing algo.
 	m_polygon_tree = std::unique_ptr<SpacialCachePolygonTree>(new SpacialCachePolygonTree(	poly_index_pair.begin(),
 																							poly_index_pair.end()));
 }
-} /* namespace data */
 
+std::size_t PolygonMesh::SpacialQueryCacheData::get_memory_usage() const {
+	std::size_t memory_usage = m_polygons.capacity() * sizeof(Polygon) + m_corners.capacity() * sizeof(Vec3);
+	if (m_is_brute_force) {
+		const PackedPolygons& packed = m_packed_polygons;
+		std::size_t float_count = packed.inverse_squared_normal_length.size() + packed.has_area.size();
+		for (int index = 0; index < 3; ++index) {
+			for (int coordinate = 0; coordinate < 3; ++coordinate) {
+				float_count += packed.vertices[index][coordinate].size()
+								+ packed.sides[index][coordinate].size()
+								+ packed.side_normals[index][coordinate].size();
+			}
+			float_count += packed.inverse_squared_side_lengths[index].size() + packed.normal[index].size();
+		}
+		memory_usage += float_count * sizeof(float);
+	} else if (m_polygon_tree) {
+		// Leaves only, inner nodes of a packed r-tree add a few percent on top
+		memory_usage += m_polygon_tree->size() * sizeof(PolygonIndexPair);
+	}
+	return memory_usage;
+}
+
+void PolygonMesh::SpacialQueryCacheData::pack_polygons() {
+	// We pad the arrays to whole blocks with copies of the first polygon, so that every block is full.
+	// Copies are never closer than the polygon itself.
+	const Eigen::Index polygon_count = static_cast<Eigen::Index>(m_polygons.size());
+	const Eigen::Index padded_count = (polygon_count + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE * SCAN_BLOCK_SIZE;
+	PackedPolygons& packed = m_packed_polygons;
+	auto resize = [padded_count](PackedVectors& a_vectors) {
+		for (Eigen::ArrayXf& coordinates : a_vectors) {
+			coordinates.resize(padded_count);
+		}
+	};
+	for (int corner = 0; corner < 3; ++corner) {
+		resize(packed.vertices[corner]);
+		resize(packed.sides[corner]);
+		resize(packed.side_normals[corner]);
+		packed.inverse_squared_side_lengths[corner].resize(padded_count);
+	}
+	resize(packed.normal);
+	packed.inverse_squared_normal_length.resize(padded_count);
+	packed.has_area.resize(padded_count);
+
+	for (Eigen::Index index = 0; index < padded_count; ++index) {
+		const Vec3* corners = &m_corners[index < polygon_count ? index * 3 : 0];
+		const Vec3 normal = (corners[1] - corners[0]).cross(corners[2] - corners[0]);
+		const float squared_normal_length = normal.squaredNorm();
+		for (int corner = 0; corner < 3; ++corner) {
+			const Vec3 side = corners[(corner + 1) % 3] - corners[corner];
+			const Vec3 side_normal = normal.cross(side);
+			const float squared_side_length = side.squaredNorm();
+			for (int axis = 0; axis < 3; ++axis) {
+				packed.vertices[corner][axis][index] = corners[corner][axis];
+				packed.sides[corner][axis][index] = side[axis];
+				packed.side_normals[corner][axis][index] = side_normal[axis];
+			}
+			packed.inverse_squared_side_lengths[corner][index] = squared_side_length > 0.0f ? 1.0f / squared_side_length : 0.0f;
+		}
+		for (int axis = 0; axis < 3; ++axis) {
+			packed.normal[axis][index] = normal[axis];
+		}
+		packed.inverse_squared_normal_length[index] = squared_normal_length > 0.0f ? 1.0f / squared_normal_length : 0.0f;
+		packed.has_area[index] = squared_normal_length > 0.0f ? 1.0f : 0.0f;
+	}
+}
+
+Location PolygonMesh::SpacialQueryCacheData::scan_closest_point(const Vec3& a_query_point, float& a_distance) const {
+
+	/** Squared distance of every polygon is found without branches, so that Eigen vectorizes it:
+	 *
+	 * - If query point projects inside the triangle, on the inner side of all of its sides,
+	 *   squared distance is that from the triangle plane.
+	 * - Else it is the least of the squared distances from the sides.
+	 *
+	 * Eigen does not vectorize comparisons, so we pick one of the two arithmetically.
+	 * Closest point on the closest polygon is then found the usual way.
+	 */
+
+	// Fixed size lets Eigen unroll and vectorize block operations completely
+	using Block = Eigen::Array<float, SCAN_BLOCK_SIZE, 1>;
+	const PackedPolygons& packed = m_packed_polygons;
+	const Eigen::Index polygon_count = static_cast<Eigen::Index>(m_polygons.size());
+	const Eigen::Index padded_count = packed.has_area.size();
+
+	float min_squared_distance = std::numeric_limits<float>::max();
+	Eigen::Index closest_index = -1;
+	for (Eigen::Index begin = 0; begin < padded_count; begin += SCAN_BLOCK_SIZE) {
+		auto block_of = [begin](const Eigen::ArrayXf& a_array) {
+			return a_array.segment<SCAN_BLOCK_SIZE>(begin);
+		};
+
+		Block side_distance = Block::Constant(std::numeric_limits<float>::max());
+		Block plane_distance;
+		// Least distance of query point inside the sides, negative if it is outside of any
+		Block inside_distance;
+		for (int corner = 0; corner < 3; ++corner) {
+			// Query point relative to the corner
+			const Block x = a_query_point.x() - block_of(packed.vertices[corner][0]);
+			const Block y = a_query_point.y() - block_of(packed.vertices[corner][1]);
+			const Block z = a_query_point.z() - block_of(packed.vertices[corner][2]);
+			const PackedVectors& side_normal = packed.side_normals[corner];
+			const Block side_normal_distance = x * block_of(side_normal[0]) + y * block_of(side_normal[1])
+					+ z * block_of(side_normal[2]);
+			if (corner == 0) {
+				plane_distance = x * block_of(packed.normal[0]) + y * block_of(packed.normal[1]) + z * block_of(packed.normal[2]);
+				inside_distance = side_normal_distance;
+			} else {
+				inside_distance = inside_distance.min(side_normal_distance);
+			}
+
+			// Closest point on the side, as a fraction of the side
+			const PackedVectors& side = packed.sides[corner];
+			const Block fraction = ((x * block_of(side[0]) + y * block_of(side[1]) + z * block_of(side[2]))
+					* block_of(packed.inverse_squared_side_lengths[corner])).max(0.0f).min(1.0f);
+			side_distance = side_distance.min((x - fraction * block_of(side[0])).square()
+					+ (y - fraction * block_of(side[1])).square()
+					+ (z - fraction * block_of(side[2])).square());
+		}
+		// 1 if inside, else 0. Points a hair outside may get a fraction, which only blends
+		// the distance from the plane, a lower bound, with that from the sides, an upper bound.
+		const Block is_inside = (1.0f - (-inside_distance).max(0.0f).min(std::numeric_limits<float>::min())
+				* (1.0f / std::numeric_limits<float>::min())) * block_of(packed.has_area);
+		const Block squared_distance = side_distance
+				+ (plane_distance.square() * block_of(packed.inverse_squared_normal_length) - side_distance) * is_inside;
+
+		Eigen::Index block_index = 0;
+		const float block_min = squared_distance.minCoeff(&block_index);
+		if (block_min < min_squared_distance) {
+			min_squared_distance = block_min;
+			closest_index = begin + block_index;
+		}
+	}
+
+	if (closest_index < 0) {
+		return INVALID_LOCATION;
+	}
+	if (closest_index >= polygon_count) {
+		// Padding, a copy of the first polygon
+		closest_index = 0;
+	}
+	return get_closest_point_on_polygon(static_cast<size_t>(closest_index), a_query_point, a_distance);
+}
+
+void PolygonMesh::SpacialQueryCacheData::insert(const PolygonMesh& a_mesh, size_t a_polygon_index) {
+	if (a_polygon_index >= m_polygons.size()) {
+		m_polygons.resize(a_polygon_index + 1);
+		m_corners.resize(m_polygons.size() * 3);
+	}
+	m_polygons[a_polygon_index] = a_mesh.m_topology[a_polygon_index];
+	for (int corner = 0; corner < 3; ++corner) {
+		m_corners[a_polygon_index * 3 + corner] = a_mesh.m_vertices[m_polygons[a_polygon_index][corner]];
+	}
+	m_polygon_tree->insert(std::make_pair(get_polygon_bounds(a_polygon_index), a_polygon_index));
+	++m_edit_count;
+}
+
+void PolygonMesh::SpacialQueryCacheData::remove(size_t a_polygon_index) {
+	// Bounds are computed from the copy made at insertion, so the r-tree finds the exact same value
+	m_polygon_tree->remove(std::make_pair(get_polygon_bounds(a_polygon_index), a_polygon_index));
+	if (a_polygon_index + 1 == m_polygons.size()) {
+		m_polygons.pop_back();
+		m_corners.resize(m_polygons.size() * 3);
+	}
+	++m_edit_count;
+}
+
+Location PolygonMesh::SpacialQueryCacheData::get_closest_point_on_polygon(size_t a_polygon_index,
+																			const Vec3& a_query_point,
+																			float& a_distance) const {
+	const Vec3& vertex1 = m_corners[a_polygon_index * 3];
+	const Vec3& vertex2 = m_corners[a_polygon_index * 3 + 1];
+	const Vec3& vertex3 = m_corners[a_polygon_index * 3 + 2];
+	const Vec3 barycentric_coords = data::get_closest_point_on_triangle(vertex1, vertex2, vertex3, a_query_point);
+	const Vec3 projected_point = Vec3(vertex1 * barycentric_coords.x()
+			+ vertex2 * barycentric_coords.y()
+			+ vertex3 * barycentric_coords.z());
+	a_distance = (projected_point - a_query_point).norm();
+	return Location { m_polygons[a_polygon_index], a_polygon_index, barycentric_coords, true };
+}
+
+Vec3 PolygonMesh::SpacialQueryCacheData::get_position(const Location& a_location) const {
+	if (!a_location.is_valid) {
+		return Vec3::Zero();
+	}
+	const size_t corner = a_location.polygon_index * 3;
+	return a_location.barycentric_coords.x() * m_corners[corner]
+			+ a_location.barycentric_coords.y() * m_corners[corner + 1]
+			+ a_location.barycentric_coords.z() * m_corners[corner + 2];
+}
+
+BoundingVolume PolygonMesh::SpacialQueryCacheData::get_polygon_bounds(size_t a_polygon_index) const {
+	BoundingVolume bounding_volume;
+	bounding_volume.extend(m_corners[a_polygon_index * 3]);
+	bounding_volume.extend(m_corners[a_polygon_index * 3 + 1]);
+	bounding_volume.extend(m_corners[a_polygon_index * 3 + 2]);
+	return bounding_volume;
+}
+
+void PolygonMesh::HierarchyCacheData::compute() {
+	const size_t polygon_count = m_mesh->get_polygon_count();
+
+	std::vector<BoundingVolume> polygon_bounds(polygon_count);
+	m_polygon_indices.resize(polygon_count);
+	tbb::parallel_for(std::size_t { 0 }, polygon_count, [&](std::size_t index) {
+		polygon_bounds[index] = m_mesh->get_polygon_bounds(index);
+		m_polygon_indices[index] = index;
+	});
+
+	m_nodes.clear();
+	m_nodes.reserve(polygon_count / 2 + 1);
+	if (polygon_count > 0) {
+		m_nodes.push_back(Node { BoundingVolume(), 0, 0, 0 });
+		build(polygon_bounds, 0, polygon_count, 0);
+	}
+	update_masks(*m_mesh);
+}
+
+void PolygonMesh::HierarchyCacheData::update_masks(const PolygonMesh& a_mesh) {
+	const size_t polygon_count = m_polygon_indices.size();
+	m_polygon_masks.resize(polygon_count);
+	for (size_t index = 0; index < polygon_count; ++index) {
+		m_polygon_masks[index] = a_mesh.get_polygon_mask(m_polygon_indices[index]);
+	}
+	// Children are always created after their parent, so walking backwards aggregates masks bottom up
+	for (size_t node_index = m_nodes.size(); node_index-- > 0;) {
+		Node& node = m_nodes[node_index];
+		node.mask = 0;
+		if (node.count > 0) {
+			for (size_t index = node.offset; index < node.offset + node.count; ++index) {
+				node.mask |= m_polygon_masks[index];
+			}
+		} else {
+			node.mask = m_nodes[node.offset].mask | m_nodes[node.offset + 1].mask;
+		}
+	}
+}
+
+void PolygonMesh::HierarchyCacheData::build(const std::vector<BoundingVolume>& a_polygon_bounds,
+												size_t a_begin,
+												size_t a_end,
+												size_t a_node_index) {
+	// Max. no. of polygons in a leaf
+	const size_t leaf_size = 4;
+
+	BoundingVolume bounds;
+	BoundingVolume centroid_bounds;
+	for (size_t index = a_begin; index < a_end; ++index) {
+		const BoundingVolume& polygon_bounds = a_polygon_bounds[m_polygon_indices[index]];
+		bounds.extend(polygon_bounds);
+		centroid_bounds.extend(polygon_bounds.center());
+	}
+	m_nodes[a_node_index].bounds = bounds;
+
+	if (a_end - a_begin <= leaf_size) {
+		m_nodes[a_node_index].count = static_cast<std::uint32_t>(a_end - a_begin);
+		m_nodes[a_node_index].offset = a_begin;
+		return;
+	}
+
+	int axis = 0;
+	centroid_bounds.sizes().maxCoeff(&axis);
+	const size_t middle = a_begin + (a_end - a_begin) / 2;
+	std::nth_element(m_polygon_indices.begin() + a_begin,
+						m_polygon_indices.begin() + middle,
+						m_polygon_indices.begin() + a_end,
+						[&](size_t a_left, size_t a_right) {
+							return a_polygon_bounds[a_left].center()[axis] < a_polygon_bounds[a_right].center()[axis];
+						});
+
+	// Children must be next to each other, so we reserve both slots before building either subtree
+	const size_t first_child = m_nodes.size();
+	m_nodes.push_back(Node { BoundingVolume(), 0, 0, 0 });
+	m_nodes.push_back(Node { BoundingVolume(), 0, 0, 0 });
+	m_nodes[a_node_index].offset = first_child;
+	build(a_polygon_bounds, a_begin, middle, first_child);
+	build(a_polygon_bounds, middle, a_end, first_child + 1);
+}
+
+template<typename NodeDistance, typename IsDone, typename VisitPolygon>
+float PolygonMesh::HierarchyCacheData::traverse(PolygonMask a_filter_mask,
+												NodeDistance a_node_distance,
+												IsDone a_is_done,
+												VisitPolygon a_visit_polygon) const {
+	if (m_nodes.empty() || (m_nodes.front().mask & a_filter_mask) == 0) {
+		return std::numeric_limits<float>::infinity();
+	}
+
+	// Min. heap of lower bound of distance and node index
+	using NodeEntry = std::pair<float, size_t>;
+	std::priority_queue<NodeEntry, std::vector<NodeEntry>, std::greater<NodeEntry>> nodes_to_visit;
+	nodes_to_visit.emplace(a_node_distance(m_nodes.front().bounds), 0);
+
+	while (!nodes_to_visit.empty()) {
+		const NodeEntry entry = nodes_to_visit.top();
+		if (a_is_done(entry.first)) {
+			return entry.first;
+		}
+		nodes_to_visit.pop();
+
+		const Node& node = m_nodes[entry.second];
+		if (node.count > 0) {
+			for (size_t index = node.offset; index < node.offset + node.count; ++index) {
+				if ((m_polygon_masks[index] & a_filter_mask) != 0) {
+					a_visit_polygon(m_polygon_indices[index]);
+				}
+			}
+			continue;
+		}
+		for (size_t child = node.offset; child < node.offset + 2; ++child) {
+			if ((m_nodes[child].mask & a_filter_mask) != 0) {
+				nodes_to_visit.emplace(a_node_distance(m_nodes[child].bounds), child);
+			}
+		}
+	}
+	return std::numeric_limits<float>::infinity();
+}
+
+} /* namespace data */
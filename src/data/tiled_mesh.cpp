@@ -0,0 +1,373 @@
+/*
+ * Author: Pratik Mankawde
+ */
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/geometry.hpp>
+
+#include <data/tiled_mesh.h>
+
+using namespace boost::geometry;
+using namespace boost::geometry::index;
+
+namespace data {
+
+namespace {
+
+/**
+ * Identifies tiled mesh files
+ */
+const char TILED_MESH_MAGIC[4] = { 'C', 'P', 'T', 'M' };
+
+const std::uint32_t TILED_MESH_VERSION = 1;
+
+/**
+ * Recursively splits polygons into tiles. Polygons are sorted by the centroid along the longest axis
+ * of centroid bounds, and split at the median, until a range has no more than a_max_polygons polygons.
+ */
+void split_into_tiles(const std::vector<Vec3>& a_centroids,
+						std::vector<std::size_t>::iterator a_begin,
+						std::vector<std::size_t>::iterator a_end,
+						std::size_t a_max_polygons,
+						std::vector<std::pair<std::size_t, std::size_t>>& a_tiles,
+						std::size_t a_offset) {
+	const std::size_t count = static_cast<std::size_t>(a_end - a_begin);
+	if (count <= a_max_polygons) {
+		a_tiles.emplace_back(a_offset, count);
+		return;
+	}
+
+	BoundingVolume centroid_bounds;
+	centroid_bounds.setEmpty();
+	for (auto it = a_begin; it != a_end; ++it) {
+		centroid_bounds.extend(a_centroids[*it]);
+	}
+	int axis = 0;
+	centroid_bounds.sizes().maxCoeff(&axis);
+
+	auto middle = a_begin + count / 2;
+	std::nth_element(a_begin, middle, a_end, [&](std::size_t a_left, std::size_t a_right) {
+		return a_centroids[a_left][axis] < a_centroids[a_right][axis];
+	});
+	split_into_tiles(a_centroids, a_begin, middle, a_max_polygons, a_tiles, a_offset);
+	split_into_tiles(a_centroids, middle, a_end, a_max_polygons, a_tiles, a_offset + count / 2);
+}
+
+} /* namespace */
+
+TiledPolygonMesh::TiledPolygonMesh()
+		: 	Data(),
+			m_file(-1),
+			m_vertex_count(0),
+			m_polygon_count(0),
+			m_tile_cache(new LRUCache<std::size_t, TileCacheData>(DEFAULT_MEMORY_BUDGET)) {
+}
+
+TiledPolygonMesh::~TiledPolygonMesh() {
+	close();
+}
+
+bool TiledPolygonMesh::write(const PolygonMesh& a_mesh, const std::string& a_path, std::size_t a_max_polygons_per_tile) {
+	const std::size_t polygon_count = a_mesh.get_polygon_count();
+	if (polygon_count < 1 || a_max_polygons_per_tile < 1) {
+		return false;
+	}
+
+	std::vector<Vec3> centroids(polygon_count);
+	std::vector<std::size_t> polygon_order(polygon_count);
+	for (std::size_t index = 0; index < polygon_count; ++index) {
+		const PolygonMesh::Polygon polygon = a_mesh.get_polygon_at(index);
+		centroids[index] = (a_mesh.get_vertex_at(polygon[0])
+							+ a_mesh.get_vertex_at(polygon[1])
+							+ a_mesh.get_vertex_at(polygon[2])) / 3.0f;
+		polygon_order[index] = index;
+	}
+
+	// Each tile is a range [first, first + count) inside polygon_order
+	std::vector<std::pair<std::size_t, std::size_t>> tile_ranges;
+	split_into_tiles(centroids, polygon_order.begin(), polygon_order.end(), a_max_polygons_per_tile, tile_ranges, 0);
+
+	std::ofstream file(a_path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		return false;
+	}
+
+	FileHeader header;
+	std::memcpy(header.magic, TILED_MESH_MAGIC, sizeof(header.magic));
+	header.version = TILED_MESH_VERSION;
+	header.tile_count = tile_ranges.size();
+	header.vertex_count = a_mesh.get_vertex_count();
+	header.polygon_count = polygon_count;
+
+	// We write tile table after tile payloads are known, for now we just reserve its space
+	std::vector<TileRecord> records(tile_ranges.size());
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(TileRecord));
+
+	// Maps vertex index in mesh to vertex index in tile being written
+	std::vector<std::uint64_t> local_vertex_index(a_mesh.get_vertex_count(), std::numeric_limits<std::uint64_t>::max());
+	for (std::size_t tile_index = 0; tile_index < tile_ranges.size(); ++tile_index) {
+		const std::size_t first = tile_ranges[tile_index].first;
+		const std::size_t count = tile_ranges[tile_index].second;
+
+		std::vector<float> positions;
+		std::vector<std::uint64_t> vertex_ids;
+		std::vector<std::uint64_t> topology;
+		std::vector<std::uint64_t> polygon_ids;
+		topology.reserve(count * 3);
+		polygon_ids.reserve(count);
+		BoundingVolume bounds;
+		bounds.setEmpty();
+
+		for (std::size_t order_index = first; order_index < first + count; ++order_index) {
+			const std::size_t polygon_index = polygon_order[order_index];
+			const PolygonMesh::Polygon polygon = a_mesh.get_polygon_at(polygon_index);
+			for (int corner = 0; corner < 3; ++corner) {
+				const std::size_t vertex_index = polygon[corner];
+				if (local_vertex_index[vertex_index] == std::numeric_limits<std::uint64_t>::max()) {
+					local_vertex_index[vertex_index] = vertex_ids.size();
+					vertex_ids.push_back(vertex_index);
+					const Vec3 position = a_mesh.get_vertex_at(vertex_index);
+					positions.insert(positions.end(), position.data(), position.data() + 3);
+					bounds.extend(position);
+				}
+				topology.push_back(local_vertex_index[vertex_index]);
+			}
+			polygon_ids.push_back(polygon_index);
+		}
+		// Reset the mapping for next tile, only touching the vertices we have used
+		for (const std::uint64_t vertex_index : vertex_ids) {
+			local_vertex_index[vertex_index] = std::numeric_limits<std::uint64_t>::max();
+		}
+
+		TileRecord& record = records[tile_index];
+		std::copy(bounds.min().data(), bounds.min().data() + 3, record.bounds_min);
+		std::copy(bounds.max().data(), bounds.max().data() + 3, record.bounds_max);
+		record.offset = static_cast<std::uint64_t>(file.tellp());
+		record.vertex_count = vertex_ids.size();
+		record.polygon_count = polygon_ids.size();
+
+		file.write(reinterpret_cast<const char*>(positions.data()), positions.size() * sizeof(float));
+		file.write(reinterpret_cast<const char*>(vertex_ids.data()), vertex_ids.size() * sizeof(std::uint64_t));
+		file.write(reinterpret_cast<const char*>(topology.data()), topology.size() * sizeof(std::uint64_t));
+		file.write(reinterpret_cast<const char*>(polygon_ids.data()), polygon_ids.size() * sizeof(std::uint64_t));
+	}
+
+	file.seekp(sizeof(FileHeader));
+	file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(TileRecord));
+	return static_cast<bool>(file);
+}
+
+bool TiledPolygonMesh::open(const std::string& a_path) {
+	close();
+
+	m_file = ::open(a_path.c_str(), O_RDONLY);
+	if (m_file < 0) {
+		return false;
+	}
+
+	struct stat file_status;
+	FileHeader header;
+	if (::fstat(m_file, &file_status) != 0
+			|| !read_at(&header, sizeof(header), 0)
+			|| std::memcmp(header.magic, TILED_MESH_MAGIC, sizeof(header.magic)) != 0
+			|| header.version != TILED_MESH_VERSION
+			|| header.tile_count < 1) {
+		close();
+		return false;
+	}
+
+	// Counts are checked against the file size before anything is computed from them, so that nothing overflows
+	const std::uint64_t file_size = static_cast<std::uint64_t>(file_status.st_size);
+	if (header.tile_count > (file_size - sizeof(FileHeader)) / sizeof(TileRecord)) {
+		close();
+		return false;
+	}
+	m_tiles.resize(header.tile_count);
+	if (!read_at(m_tiles.data(), m_tiles.size() * sizeof(TileRecord), sizeof(FileHeader))) {
+		close();
+		return false;
+	}
+
+	// Tiles must lie after the tile table and within the file, and add up to the whole mesh
+	const std::uint64_t payload_offset = sizeof(FileHeader) + m_tiles.size() * sizeof(TileRecord);
+	std::uint64_t polygon_count = 0;
+	for (const TileRecord& record : m_tiles) {
+		const std::uint64_t vertex_size = sizeof(float) * 3 + sizeof(std::uint64_t);
+		const std::uint64_t polygon_size = sizeof(std::uint64_t) * 4;
+		if (record.offset < payload_offset
+				|| record.offset > file_size
+				|| record.vertex_count > (file_size - record.offset) / vertex_size
+				|| record.polygon_count > (file_size - record.offset - record.vertex_count * vertex_size) / polygon_size) {
+			close();
+			return false;
+		}
+		polygon_count += record.polygon_count;
+	}
+	if (polygon_count != header.polygon_count) {
+		close();
+		return false;
+	}
+	m_vertex_count = header.vertex_count;
+	m_polygon_count = header.polygon_count;
+
+	std::vector<TileIndexPair> tile_index_pairs;
+	tile_index_pairs.reserve(m_tiles.size());
+	for (std::size_t index = 0; index < m_tiles.size(); ++index) {
+		const TileRecord& record = m_tiles[index];
+		tile_index_pairs.emplace_back(BoundingVolume(Vec3(record.bounds_min), Vec3(record.bounds_max)), index);
+	}
+	m_tile_tree.reset(new rtree<TileIndexPair, quadratic<16>>(tile_index_pairs.begin(), tile_index_pairs.end()));
+	return true;
+}
+
+void TiledPolygonMesh::close() {
+	if (m_file >= 0) {
+		::close(m_file);
+		m_file = -1;
+	}
+	m_tiles.clear();
+	m_tile_tree.reset();
+	m_vertex_count = 0;
+	m_polygon_count = 0;
+	m_tile_cache->invalidate();
+}
+
+bool TiledPolygonMesh::read_at(void* a_buffer, std::size_t a_size, std::uint64_t a_offset) const {
+	char* buffer = static_cast<char*>(a_buffer);
+	while (a_size > 0) {
+		const ssize_t read_count = ::pread(m_file, buffer, a_size, static_cast<off_t>(a_offset));
+		if (read_count <= 0) {
+			return false;
+		}
+		buffer += read_count;
+		a_size -= static_cast<std::size_t>(read_count);
+		a_offset += static_cast<std::uint64_t>(read_count);
+	}
+	return true;
+}
+
+Location TiledPolygonMesh::closest_point(const Vec3& a_query_point, Vec3* a_closest_position) const {
+
+	/** Steps followed to calculate closest point:
+	 *
+	 * - Visit tiles in increasing order of distance of their bounds from the query point
+	 * - Stop once the bounds of the next tile are farther than the closest point found so far
+	 * - Load the tile (from the tile cache or disk) and query its mesh
+	 * - Keep the closest of the points found, mapped back to original mesh indices
+	 */
+
+	if (!m_tile_tree) {
+		return INVALID_LOCATION;
+	}
+
+	Location closest_location = INVALID_LOCATION;
+	Vec3 closest_position = Vec3::Zero();
+	float min_distance = std::numeric_limits<float>::max();
+
+	for (auto it = m_tile_tree->qbegin(nearest(a_query_point, static_cast<unsigned>(m_tiles.size())));
+			it != m_tile_tree->qend(); ++it) {
+		// comparable_distance gives squared distance for cartesian points
+		if (comparable_distance(a_query_point, it->first) >= min_distance) {
+			break;
+		}
+
+		const std::shared_ptr<TileCacheData> tile = m_tile_cache->get_cached_data(shared_from_this(), it->second);
+		if (!tile->is_computed()) {
+			// Skipping the tile could silently give us a point farther than the closest one
+			return INVALID_LOCATION;
+		}
+		const Location location = tile->get_mesh()->closest_point(a_query_point);
+		if (!location.is_valid) {
+			continue;
+		}
+		const Vec3 position = tile->get_mesh()->get_spacial_position(location);
+		const float distance = (position - a_query_point).squaredNorm();
+		if (distance < min_distance) {
+			min_distance = distance;
+			closest_position = position;
+			closest_location = tile->to_global(location);
+		}
+	}
+
+	if (a_closest_position != nullptr && closest_location.is_valid) {
+		*a_closest_position = closest_position;
+	}
+	return closest_location;
+}
+
+std::shared_ptr<const PolygonMesh> TiledPolygonMesh::get_tile_mesh(std::size_t a_tile_index) const {
+	if (a_tile_index >= m_tiles.size()) {
+		return nullptr;
+	}
+	const std::shared_ptr<TileCacheData> tile = m_tile_cache->get_cached_data(shared_from_this(), a_tile_index);
+	return tile->is_computed() ? tile->get_mesh() : nullptr;
+}
+
+void TiledPolygonMesh::TileCacheData::compute() {
+	const TileRecord& record = m_tiled_mesh->m_tiles[m_tile_index];
+
+	std::vector<float> positions(record.vertex_count * 3);
+	std::vector<std::uint64_t> topology(record.polygon_count * 3);
+	m_vertex_ids.resize(record.vertex_count);
+	m_polygon_ids.resize(record.polygon_count);
+
+	std::uint64_t offset = record.offset;
+	m_is_computed = m_tiled_mesh->read_at(positions.data(), positions.size() * sizeof(float), offset);
+	offset += positions.size() * sizeof(float);
+	m_is_computed = m_is_computed && m_tiled_mesh->read_at(m_vertex_ids.data(), m_vertex_ids.size() * sizeof(std::uint64_t), offset);
+	offset += m_vertex_ids.size() * sizeof(std::uint64_t);
+	m_is_computed = m_is_computed && m_tiled_mesh->read_at(topology.data(), topology.size() * sizeof(std::uint64_t), offset);
+	offset += topology.size() * sizeof(std::uint64_t);
+	m_is_computed = m_is_computed && m_tiled_mesh->read_at(m_polygon_ids.data(), m_polygon_ids.size() * sizeof(std::uint64_t), offset);
+
+	// Indices are used as they are by queries and by callers of to_global, a corrupt tile must not get that far
+	m_is_computed = m_is_computed
+			&& std::all_of(m_vertex_ids.begin(), m_vertex_ids.end(), [&](std::uint64_t a_id) {
+				return a_id < m_tiled_mesh->m_vertex_count;
+			})
+			&& std::all_of(m_polygon_ids.begin(), m_polygon_ids.end(), [&](std::uint64_t a_id) {
+				return a_id < m_tiled_mesh->m_polygon_count;
+			})
+			&& std::all_of(topology.begin(), topology.end(), [&](std::uint64_t a_index) {
+				return a_index < record.vertex_count;
+			});
+
+	std::vector<Vec3> vertices(record.vertex_count);
+	for (std::size_t index = 0; index < vertices.size(); ++index) {
+		vertices[index] = Vec3(positions[index * 3], positions[index * 3 + 1], positions[index * 3 + 2]);
+	}
+	std::vector<PolygonMesh::Polygon> polygons(record.polygon_count);
+	for (std::size_t index = 0; index < polygons.size(); ++index) {
+		polygons[index] = PolygonMesh::Polygon(topology[index * 3], topology[index * 3 + 1], topology[index * 3 + 2]);
+	}
+
+	m_mesh = PolygonMesh::create();
+	m_is_computed = m_is_computed && m_mesh->build_mesh(vertices, polygons);
+	if (m_is_computed) {
+		m_index_memory_usage = m_mesh->get_spacial_index_memory_usage();
+	}
+}
+
+std::size_t TiledPolygonMesh::TileCacheData::get_memory_usage() const {
+	return m_vertex_ids.size() * (sizeof(Vec3) + sizeof(std::uint64_t))
+			+ m_polygon_ids.size() * (sizeof(PolygonMesh::Polygon) + sizeof(PolygonMask) + sizeof(std::uint64_t))
+			+ m_index_memory_usage;
+}
+
+Location TiledPolygonMesh::TileCacheData::to_global(const Location& a_location) const {
+	Location location = a_location;
+	location.polygon_index = m_polygon_ids[a_location.polygon_index];
+	for (int corner = 0; corner < 3; ++corner) {
+		location.vertex_indices[corner] = m_vertex_ids[a_location.vertex_indices[corner]];
+	}
+	return location;
+}
+
+} /* namespace data */
@@ -0,0 +1,263 @@
+/*
+ * Author: Pratik Mankawde
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <vector>
+
+#include <data/spacial.h>
+#include <types.h>
+
+namespace data {
+
+/**
+ * Name of the per-vertex Vec3 attribute used as surface normal, when present
+ */
+static const std::string NORMAL_ATTRIBUTE = "normal";
+
+/**
+ * Elements of a geometry an attribute stores one value for
+ * - VERTEX	: One value per vertex, interpolated with barycentric coordinates
+ * - FACE	: One value per polygon, constant over the polygon
+ */
+enum class AttributeDomain {
+	VERTEX,
+	FACE
+};
+
+/**
+ * Describes how to read attribute values as a set of float components.
+ * Works for Eigen fixed size vectors like \ref Vec2 and \ref Vec3, float is specialised below.
+ */
+template<typename ValueType>
+struct AttributeTraits {
+		static const std::size_t component_count = ValueType::RowsAtCompileTime;
+
+		static float get_component(const ValueType& a_value, std::size_t a_component) {
+			return a_value[a_component];
+		}
+
+		static ValueType zero() {
+			return ValueType::Zero();
+		}
+};
+
+template<>
+struct AttributeTraits<float> {
+		static const std::size_t component_count = 1;
+
+		static float get_component(const float& a_value, std::size_t) {
+			return a_value;
+		}
+
+		static float zero() {
+			return 0.0f;
+		}
+};
+
+/**
+ * A range of locations unpacked into Structure of Arrays, so that values can be evaluated one component at a time,
+ * in tight loops without branches. Invalid locations, and those referring to elements the geometry does not have,
+ * get zero weights and refer to element 0 instead, so they evaluate to zero.
+ */
+struct LocationBlock {
+		std::size_t count = 0;
+		std::array<std::vector<float>, 3> weights;					// barycentric coordinates
+		std::array<std::vector<std::size_t>, 3> vertex_indices;		// vertices of polygon
+		std::vector<std::size_t> polygon_indices;					// polygon
+		std::vector<float> validity;								// 1 for valid locations, else 0
+
+		/**
+		 * @param a_locations locations to unpack
+		 * @param a_count no. of locations
+		 * @param a_vertex_count no. of vertices of geometry the locations are on
+		 * @param a_polygon_count no. of polygons of geometry the locations are on
+		 */
+		void assign(const Location* a_locations, std::size_t a_count, std::size_t a_vertex_count, std::size_t a_polygon_count) {
+			count = a_count;
+			for (int corner = 0; corner < 3; ++corner) {
+				weights[corner].resize(a_count);
+				vertex_indices[corner].resize(a_count);
+			}
+			polygon_indices.resize(a_count);
+			validity.resize(a_count);
+			for (std::size_t index = 0; index < a_count; ++index) {
+				const Location& location = a_locations[index];
+				const bool is_valid = location.is_valid
+										&& location.polygon_index < a_polygon_count
+										&& location.vertex_indices.maxCoeff() < a_vertex_count;
+				for (int corner = 0; corner < 3; ++corner) {
+					weights[corner][index] = is_valid ? location.barycentric_coords[corner] : 0.0f;
+					vertex_indices[corner][index] = is_valid ? location.vertex_indices[corner] : 0;
+				}
+				polygon_indices[index] = is_valid ? location.polygon_index : 0;
+				validity[index] = is_valid ? 1.0f : 0.0f;
+			}
+		}
+};
+
+/**
+ * Interpolates per-vertex values at a block of locations, one component at a time.
+ * @param a_values one value per vertex, must not be empty
+ * @param a_block locations to evaluate at
+ * @param a_outputs one array per component, each with room for a value per location. Null arrays are skipped.
+ */
+template<typename ValueType>
+void interpolate_vertex_values(const std::vector<ValueType>& a_values, const LocationBlock& a_block, float* const* a_outputs) {
+	using Traits = AttributeTraits<ValueType>;
+	for (std::size_t component = 0; component < Traits::component_count; ++component) {
+		float* output = a_outputs[component];
+		if (output == nullptr) {
+			continue;
+		}
+		for (std::size_t index = 0; index < a_block.count; ++index) {
+			output[index] = a_block.weights[0][index] * Traits::get_component(a_values[a_block.vertex_indices[0][index]], component)
+							+ a_block.weights[1][index] * Traits::get_component(a_values[a_block.vertex_indices[1][index]], component)
+							+ a_block.weights[2][index] * Traits::get_component(a_values[a_block.vertex_indices[2][index]], component);
+		}
+	}
+}
+
+/**
+ * Type independent interface of an attribute channel, so that a geometry can store channels of different types together.
+ */
+class AttributeChannelBase {
+	public:
+		AttributeChannelBase(AttributeDomain a_domain)
+				: 	m_domain(a_domain) {
+		}
+
+		virtual ~AttributeChannelBase() = default;
+
+		AttributeDomain get_domain() const {
+			return m_domain;
+		}
+
+		/**
+		 * @return No. of float components in each value
+		 */
+		virtual std::size_t get_component_count() const = 0;
+
+		/**
+		 * @return No. of values stored
+		 */
+		virtual std::size_t get_size() const = 0;
+
+		/**
+		 * Resizes channel, new values are zero initialized. Used to keep channel in sync when geometry grows.
+		 * @param a_size new no. of values
+		 */
+		virtual void resize(std::size_t a_size) = 0;
+
+		/**
+		 * Removes a value by moving the last value into its place, same as polygon removal from \ref PolygonMesh.
+		 * @param a_index index of value to remove
+		 */
+		virtual void swap_remove(std::size_t a_index) = 0;
+
+		/**
+		 * Evaluates the channel at a block of locations, writing components into separate arrays.
+		 * Invalid locations evaluate to zero.
+		 * @param a_block locations to evaluate at
+		 * @param a_outputs one array per component, each with room for a value per location. Null arrays are skipped.
+		 */
+		virtual void interpolate(const LocationBlock& a_block, float* const* a_outputs) const = 0;
+
+	private:
+		AttributeDomain m_domain;
+};
+
+/**
+ * Attribute values stored contiguously, one per element of the channel's domain.
+ */
+template<typename ValueType>
+class AttributeChannel : public AttributeChannelBase {
+	public:
+		using Traits = AttributeTraits<ValueType>;
+
+		AttributeChannel(AttributeDomain a_domain, const std::vector<ValueType>& a_values)
+				: 	AttributeChannelBase(a_domain),
+					m_values(a_values) {
+		}
+
+		std::size_t get_component_count() const override {
+			return Traits::component_count;
+		}
+
+		std::size_t get_size() const override {
+			return m_values.size();
+		}
+
+		void resize(std::size_t a_size) override {
+			m_values.resize(a_size, zero());
+		}
+
+		void swap_remove(std::size_t a_index) override {
+			m_values[a_index] = m_values.back();
+			m_values.pop_back();
+		}
+
+		void interpolate(const LocationBlock& a_block, float* const* a_outputs) const override {
+			if (m_values.empty()) {
+				// No element to refer to, so no location can be valid
+				for (std::size_t component = 0; component < Traits::component_count; ++component) {
+					if (a_outputs[component] != nullptr) {
+						std::fill(a_outputs[component], a_outputs[component] + a_block.count, 0.0f);
+					}
+				}
+			} else if (get_domain() == AttributeDomain::VERTEX) {
+				interpolate_vertex_values(m_values, a_block, a_outputs);
+			} else {
+				for (std::size_t component = 0; component < Traits::component_count; ++component) {
+					float* output = a_outputs[component];
+					if (output == nullptr) {
+						continue;
+					}
+					for (std::size_t index = 0; index < a_block.count; ++index) {
+						output[index] = a_block.validity[index]
+										* Traits::get_component(m_values[a_block.polygon_indices[index]], component);
+					}
+				}
+			}
+		}
+
+		/**
+		 * Gives direct access to values, for example to evaluate them along with other data
+		 * @return attribute values
+		 */
+		const std::vector<ValueType>& get_values() const {
+			return m_values;
+		}
+
+	private:
+		static ValueType zero() {
+			return Traits::zero();
+		}
+
+		std::vector<ValueType> m_values;
+};
+
+/**
+ * Destination of one attribute in \ref EvaluationBuffers
+ * - name		: name of the attribute to evaluate
+ * - components	: one array per component of attribute, each with room for a value per location
+ */
+struct AttributeOutput {
+		std::string name;
+		std::vector<float*> components;
+};
+
+/**
+ * Caller provided Structure of Arrays buffers for batch evaluation of locations.
+ * Each array must have room for a value per location. Null arrays are skipped.
+ */
+struct EvaluationBuffers {
+		std::array<float*, 3> positions {{ nullptr, nullptr, nullptr }};	// x, y and z of position
+		std::array<float*, 3> normals {{ nullptr, nullptr, nullptr }};		// x, y and z of unit surface normal
+		std::vector<AttributeOutput> attributes;							// Any other attributes to evaluate
+};
+
+} /* namespace data */
@@ -3,7 +3,17 @@
  */
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <vector>
+
+#include <tbb/task_group.h>
+
 #include <data/data.h>
 #include <types.h>
 
@@ -22,7 +32,8 @@ class CacheData : public Data {
 		 */
 		CacheData(std::shared_ptr<const Data> a_data)
 				: 	Data(),
-					m_data(a_data) {
+					m_data(a_data),
+					m_data_version(a_data ? a_data->get_version() : 0) {
 		};
 
 		~CacheData() = default;
@@ -33,16 +44,60 @@ class CacheData : public Data {
 		 */
 		virtual void compute() = 0;
 
+		/**
+		 * Approximate no. of bytes held by this cache data. Caches working under a memory budget,
+		 * like \ref LRUCache, use it to decide when to evict. Subclasses should override it.
+		 * @return Memory used in bytes
+		 */
+		virtual std::size_t get_memory_usage() const {
+			return 0;
+		}
+
+		/**
+		 * Checks if compute() managed to construct the data. Subclasses whose compute() can fail,
+		 * for example because reading from disk failed, should override it. Caches like \ref LRUCache
+		 * do not keep data which failed, so that it is computed again on next request.
+		 * @return false if compute() failed
+		 */
+		virtual bool is_computed() const {
+			return true;
+		}
+
+		/**
+		 * Version of m_data this cache data is up to date with
+		 */
+		std::size_t get_data_version() const {
+			return m_data_version;
+		}
+
+		/**
+		 * Subclasses updating themselves incrementally, instead of through compute(),
+		 * use this to mark that they have caught up with a newer version of m_data.
+		 * @param a_data_version version of m_data
+		 */
+		void set_data_version(std::size_t a_data_version) {
+			m_data_version = a_data_version;
+		}
+
 	protected:
 		/**
 		 * m_data will provide necessary data for constructing cache
 		 */
 		std::shared_ptr<const Data> m_data;
+
+	private:
+		/**
+		 * Version of m_data, cache data was computed from
+		 */
+		std::size_t m_data_version;
 };
 
 /**
  * Abstract Base class representing data caches.
  * Cache creation and handing will be taken care by sub classes implementing this class
+ * \ref get_cached_data can be called from multiple threads at once, threads asking for out of date data wait
+ * for one of them to compute it. Data is never replaced while a_data stays the same, so the reference handed out
+ * stays good until a_data changes or cache is invalidated, neither of which may happen while others use the cache.
  */
 template<typename CacheDataType>
 class Cache {
@@ -55,6 +110,7 @@ class Cache {
 		 * Function to invalidate cache
 		 */
 		virtual void invalidate() {
+			m_current_data.store(nullptr, std::memory_order_release);
 			m_cache_data = nullptr;
 		}
 		/**
@@ -66,26 +122,423 @@ class Cache {
 		}
 
 		/**
-		 * This function creates a cache data object and populate cache.
+		 * Checks if the cache is valid and up to date with the given version of data.
+		 * @param a_data Data cache was generated from
+		 */
+		virtual bool is_valid(const Data& a_data) {
+			return is_valid() && m_cache_data->get_data_version() == a_data.get_version();
+		}
+
+		/**
+		 * This function creates a cache data object and populate cache. Cache data is recomputed
+		 * if a_data has changed since cache was populated.
 		 * It has been made virtual so that sub-classes can implement their own behaviour if desired
 		 * @param a_data Data used for generating cache
 		 * @return Ref. to unique_pointer to cached data.
 		 */
 		virtual const std::unique_ptr<CacheDataType>& get_cached_data(std::shared_ptr<const Data> a_data) {
-			if (!static_cast<bool>(m_cache_data)) {
-				m_cache_data = std::unique_ptr<CacheDataType>(new CacheDataType(a_data));
-				m_cache_data->compute();
+			// Data is up to date most of the time, which costs us a single load
+			const CacheDataType* current_data = m_current_data.load(std::memory_order_acquire);
+			if (current_data == nullptr || current_data->get_data_version() != a_data->get_version()) {
+				std::lock_guard<std::mutex> lock(m_compute_mutex);
+				// Another thread might have computed it while we were waiting
+				if (!is_valid(*a_data)) {
+					m_cache_data = std::unique_ptr<CacheDataType>(new CacheDataType(a_data));
+					m_cache_data->compute();
+					m_current_data.store(m_cache_data.get(), std::memory_order_release);
+				}
 			}
 			return m_cache_data;
 		}
+
+		/**
+		 * Returns cached data as it is, without populating or updating it.
+		 * Useful for caches which can be brought up to date incrementally.
+		 * @return Ref. to unique_pointer to cached data, which can be null or out of date.
+		 */
+		const std::unique_ptr<CacheDataType>& get_current_data() const {
+			return m_cache_data;
+		}
 	private:
-		// TODO When used under parallel access, there should be a mutex
-		// defined here for synchronisation
-		// mutable tbb::...::mutex;
 		/**
 		 *	Unique pointer to the cached data We do not want the ownership to be shared
 		 */
 		std::unique_ptr<CacheDataType> m_cache_data;
+
+		/**
+		 * Same as m_cache_data, published for threads checking it without holding \ref m_compute_mutex
+		 */
+		std::atomic<const CacheDataType*> m_current_data { nullptr };
+
+		/**
+		 * Serializes computing data
+		 */
+		std::mutex m_compute_mutex;
+};
+
+/**
+ * Cache whose data can be rebuilt in background while readers keep using the data they already have,
+ * in read-copy-update fashion. Readers take a snapshot, a shared_ptr to cache data which is not modified anymore,
+ * and rebuilt data is published by atomically swapping the pointer. Replaced data is kept aside until no reader
+ * holds a snapshot of it, and freed by the next rebuild or the thread modifying a_data, never by a reader.
+ * Freeing a large index takes long enough to show up as query latency otherwise.
+ * Data is also handed out the way \ref Cache does it, through \ref get_cached_data, which costs no more than
+ * \ref Cache when nothing is rebuilt in background. Data computed there is published as well, so readers
+ * can start taking snapshots at any point.
+ * CacheDataType must copy whatever it needs from a_data in its constructor, since compute() of a background
+ * rebuild runs while a_data may be changing again.
+ */
+template<typename CacheDataType>
+class SnapshotCache {
+	public:
+		SnapshotCache() = default;
+
+		virtual ~SnapshotCache() {
+			// Background rebuilds refer to this cache
+			m_rebuild_tasks.wait();
+		}
+
+		/**
+		 * Drops the data, published one included. Readers holding a snapshot of it can keep using it.
+		 * Must be called from the thread modifying a_data.
+		 */
+		virtual void invalidate() {
+			set_current_data(nullptr);
+			retire(std::atomic_exchange(&m_published_data, std::shared_ptr<CacheDataType>()));
+			reclaim();
+		}
+
+		/**
+		 * Checks if data handed out by \ref get_cached_data is up to date with the given version of data.
+		 * Background rebuilds count once \ref wait has been called.
+		 * @param a_data Data cache was generated from
+		 */
+		virtual bool is_valid(const Data& a_data) const {
+			return static_cast<bool>(m_cache_data) && m_cache_data->get_data_version() == a_data.get_version();
+		}
+
+		/**
+		 * Returns the published data as it is, without waiting for anything. Safe to call from any thread.
+		 * @return Snapshot of cached data, can be null or out of date.
+		 */
+		std::shared_ptr<const CacheDataType> get_snapshot() const {
+			return std::atomic_load(&m_published_data);
+		}
+
+		/**
+		 * Returns data up to date with a_data, computing it on the calling thread and publishing it if required.
+		 * Threads asking for out of date data at the same time wait for one of them to compute it.
+		 * Same as \ref Cache::get_cached_data, reference handed out stays good until a_data changes.
+		 * @param a_data Data used for generating cache
+		 * @return Ref. to shared_ptr to cached data.
+		 */
+		virtual const std::shared_ptr<CacheDataType>& get_cached_data(std::shared_ptr<const Data> a_data) {
+			// Data is up to date most of the time, which costs us a single load
+			const CacheDataType* current_data = m_current_data.load(std::memory_order_acquire);
+			if (current_data == nullptr || current_data->get_data_version() != a_data->get_version()) {
+				std::lock_guard<std::mutex> lock(m_compute_mutex);
+				// Another thread might have computed it while we were waiting
+				if (!is_valid(*a_data)) {
+					// Or a background rebuild might have published it
+					std::shared_ptr<CacheDataType> cache_data = std::atomic_load(&m_published_data);
+					if (!cache_data || cache_data->get_data_version() != a_data->get_version()) {
+						cache_data = std::shared_ptr<CacheDataType>(new CacheDataType(a_data));
+						cache_data->compute();
+						publish(cache_data);
+					}
+					set_current_data(cache_data);
+				}
+			}
+			return m_cache_data;
+		}
+
+		/**
+		 * Computes data for the current version of a_data on the calling thread and publishes it, even if data
+		 * of the same version is published already. Meant for changes of settings the data depends on, which
+		 * do not change the version of a_data. Must be called from the thread modifying a_data.
+		 * @param a_data Data used for generating cache
+		 */
+		void rebuild(std::shared_ptr<const Data> a_data) {
+			// Background rebuilds started before the change must not publish after us
+			m_rebuild_tasks.wait();
+			std::shared_ptr<CacheDataType> cache_data(new CacheDataType(a_data));
+			cache_data->compute();
+			retire(std::atomic_exchange(&m_published_data, cache_data));
+			set_current_data(cache_data);
+			reclaim();
+		}
+
+		/**
+		 * Starts computing data for the current version of a_data in background, and publishes it when done.
+		 * Readers keep getting the previously published data until then. Rebuilds still waiting to start when
+		 * a newer one is requested are skipped, so a burst of changes costs one rebuild once they settle.
+		 * Must be called from the thread modifying a_data, after modifying it.
+		 * @param a_data Data used for generating cache
+		 */
+		void rebuild_async(std::shared_ptr<const Data> a_data) {
+			m_requested_version.store(a_data->get_version(), std::memory_order_relaxed);
+			std::shared_ptr<CacheDataType> cache_data(new CacheDataType(a_data));
+			m_rebuild_tasks.run([this, cache_data]() {
+				if (cache_data->get_data_version() < m_requested_version.load(std::memory_order_relaxed)) {
+					return;
+				}
+				cache_data->compute();
+				publish(cache_data);
+				reclaim();
+			});
+			reclaim();
+		}
+
+		/**
+		 * Waits for all background rebuilds started so far to be published, and hands out the published data
+		 * from \ref get_cached_data and \ref get_mutable_data from then on. Must be called from the thread
+		 * starting the rebuilds.
+		 */
+		void wait() {
+			m_rebuild_tasks.wait();
+			const std::shared_ptr<CacheDataType> published_data = std::atomic_load(&m_published_data);
+			if (published_data != m_cache_data) {
+				set_current_data(published_data);
+			}
+			reclaim();
+		}
+
+		/**
+		 * Returns data handed out by \ref get_cached_data for updating it in place.
+		 * Only safe when no other thread is reading it, snapshots included.
+		 * @return Pointer to cached data, can be null or out of date.
+		 */
+		CacheDataType* get_mutable_data() {
+			return m_cache_data.get();
+		}
+
+	private:
+		/**
+		 * Publishes data, unless data computed from a newer version of m_data is already published.
+		 * Rebuilds can finish out of order.
+		 * @param a_cache_data Data to publish
+		 */
+		void publish(const std::shared_ptr<CacheDataType>& a_cache_data) {
+			std::shared_ptr<CacheDataType> current = std::atomic_load(&m_published_data);
+			while (!current || current->get_data_version() < a_cache_data->get_data_version()) {
+				if (std::atomic_compare_exchange_weak(&m_published_data, &current, a_cache_data)) {
+					retire(current);
+					break;
+				}
+			}
+		}
+
+		/**
+		 * Hands out a_cache_data from \ref get_cached_data
+		 */
+		void set_current_data(const std::shared_ptr<CacheDataType>& a_cache_data) {
+			retire(m_cache_data);
+			m_cache_data = a_cache_data;
+			m_current_data.store(m_cache_data.get(), std::memory_order_release);
+		}
+
+		/**
+		 * Keeps replaced data aside, so that the reader dropping the last snapshot of it does not free it.
+		 * @param a_cache_data Data not handed out anymore, can be null
+		 */
+		void retire(const std::shared_ptr<CacheDataType>& a_cache_data) {
+			if (!a_cache_data) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(m_retired_mutex);
+			// Data handed out from get_cached_data and published is replaced on both sides, we keep one reference
+			if (std::find(m_retired_data.begin(), m_retired_data.end(), a_cache_data) == m_retired_data.end()) {
+				m_retired_data.push_back(a_cache_data);
+			}
+		}
+
+		/**
+		 * Frees retired data no reader holds a snapshot of anymore. Retired data cannot be handed out again,
+		 * so once we hold the only reference to it, nobody else can take one.
+		 */
+		void reclaim() {
+			std::vector<std::shared_ptr<CacheDataType>> unused_data;
+			{
+				std::lock_guard<std::mutex> lock(m_retired_mutex);
+				auto used_end = std::partition(m_retired_data.begin(), m_retired_data.end(),
+						[](const std::shared_ptr<CacheDataType>& a_cache_data) {
+							return a_cache_data.use_count() > 1;
+						});
+				std::move(used_end, m_retired_data.end(), std::back_inserter(unused_data));
+				m_retired_data.erase(used_end, m_retired_data.end());
+			}
+			// Freed here, outside the lock, so that a rebuild publishing meanwhile does not wait for us
+		}
+
+		/**
+		 * Data handed out by \ref get_cached_data. Also published, unless a background rebuild has
+		 * published newer data since.
+		 */
+		std::shared_ptr<CacheDataType> m_cache_data;
+
+		/**
+		 * Same as m_cache_data, for threads checking it without holding \ref m_compute_mutex
+		 */
+		std::atomic<const CacheDataType*> m_current_data { nullptr };
+
+		/**
+		 * Published cache data, only ever accessed through std::atomic_* functions
+		 */
+		std::shared_ptr<CacheDataType> m_published_data;
+
+		/**
+		 * Data replaced, which readers may still hold snapshots of, see \ref reclaim
+		 */
+		std::vector<std::shared_ptr<CacheDataType>> m_retired_data;
+
+		/**
+		 * Guards m_retired_data, which background rebuilds add to
+		 */
+		std::mutex m_retired_mutex;
+
+		/**
+		 * Version of m_data of the latest background rebuild requested
+		 */
+		std::atomic<std::size_t> m_requested_version { 0 };
+
+		/**
+		 * Serializes computing data on reader threads
+		 */
+		std::mutex m_compute_mutex;
+
+		/**
+		 * Background rebuilds in flight
+		 */
+		tbb::task_group m_rebuild_tasks;
+};
+
+/**
+ * Counters describing how well a cache is doing. Useful for tuning memory budgets.
+ */
+struct CacheStatistics {
+		std::size_t hits;			// No. of requests served from cache
+		std::size_t misses;			// No. of requests which had to compute cache data
+		std::size_t evictions;		// No. of cache data objects dropped to stay under budget
+		std::size_t memory_usage;	// Bytes currently held by the cache
+};
+
+/**
+ * Cache holding many cache data objects, one per key, under a memory budget.
+ * When the budget is exceeded, least recently used entries are evicted first.
+ * CacheDataType must be constructible from (std::shared_ptr<const Data>, KeyType) and derive from \ref CacheData.
+ * Unlike \ref Cache, entries are handed out as shared_ptr so that an entry evicted while
+ * caller is still using it stays alive until the caller is done with it.
+ * All the functions are safe to call from multiple threads. Entries are computed under the same lock,
+ * so threads missing the cache at the same time compute one entry after the other.
+ */
+template<typename KeyType, typename CacheDataType>
+class LRUCache {
+	public:
+		/**
+		 * @param a_memory_budget Max. no. of bytes the cache may hold. Most recently used entry is
+		 * 						  always kept, even if it alone exceeds the budget.
+		 */
+		LRUCache(std::size_t a_memory_budget)
+				: 	m_memory_budget(a_memory_budget),
+					m_statistics { 0, 0, 0, 0 } {
+		}
+
+		virtual ~LRUCache() = default;
+
+		/**
+		 * Drops all the entries. Statistics are kept.
+		 */
+		virtual void invalidate() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_entries.clear();
+			m_lookup.clear();
+			m_statistics.memory_usage = 0;
+		}
+
+		/**
+		 * Returns cache data for a key, computing it if it is not resident. Cache data whose compute() failed
+		 * is returned without keeping it, callers are expected to check \ref CacheData::is_computed.
+		 * @param a_data Data used for generating cache
+		 * @param a_key Key identifying the entry
+		 * @return shared pointer to cached data.
+		 */
+		virtual std::shared_ptr<CacheDataType> get_cached_data(std::shared_ptr<const Data> a_data, const KeyType& a_key) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto found = m_lookup.find(a_key);
+			if (found != m_lookup.end()) {
+				++m_statistics.hits;
+				// Move the entry to the front, marking it as most recently used
+				m_entries.splice(m_entries.begin(), m_entries, found->second);
+				return found->second->second;
+			}
+
+			++m_statistics.misses;
+			std::shared_ptr<CacheDataType> cache_data(new CacheDataType(a_data, a_key));
+			cache_data->compute();
+			if (!cache_data->is_computed()) {
+				return cache_data;
+			}
+			m_entries.emplace_front(a_key, cache_data);
+			m_lookup[a_key] = m_entries.begin();
+			m_statistics.memory_usage += cache_data->get_memory_usage();
+			evict();
+			return cache_data;
+		}
+
+		/**
+		 * Updates memory budget, evicting entries if required.
+		 * @param a_memory_budget Max. no. of bytes the cache may hold.
+		 */
+		void set_memory_budget(std::size_t a_memory_budget) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_memory_budget = a_memory_budget;
+			evict();
+		}
+
+		std::size_t get_memory_budget() const {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_memory_budget;
+		}
+
+		CacheStatistics get_statistics() const {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_statistics;
+		}
+
+	private:
+		using Entry = std::pair<KeyType, std::shared_ptr<CacheDataType>>;
+
+		/**
+		 * Evicts least recently used entries until we are under the budget. Caller must hold \ref m_mutex.
+		 */
+		void evict() {
+			while (m_statistics.memory_usage > m_memory_budget && m_entries.size() > 1) {
+				const Entry& entry = m_entries.back();
+				m_statistics.memory_usage -= entry.second->get_memory_usage();
+				++m_statistics.evictions;
+				m_lookup.erase(entry.first);
+				m_entries.pop_back();
+			}
+		}
+
+		/**
+		 * Guards entries, budget and statistics
+		 */
+		mutable std::mutex m_mutex;
+
+		/**
+		 * Entries ordered from most to least recently used
+		 */
+		std::list<Entry> m_entries;
+
+		/**
+		 * Key to entry lookup
+		 */
+		std::map<KeyType, typename std::list<Entry>::iterator> m_lookup;
+
+		std::size_t m_memory_budget;
+
+		CacheStatistics m_statistics;
 };
 
 } /* namespace data */
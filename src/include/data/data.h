@@ -3,6 +3,9 @@
  */
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+
 namespace data {
 
 /**
@@ -12,8 +15,31 @@ namespace data {
  */
 class Data {
 	public:
-		Data() = default;
+		Data()
+				: 	m_version(0) {
+		};
 		virtual ~Data() = default;
+
+		/**
+		 * Version of the data. It changes every time data is modified, so that anything derived
+		 * from it (caches for example) can tell whether it is out of date. Safe to read from any thread,
+		 * even while data is being modified.
+		 * @return current version
+		 */
+		std::size_t get_version() const {
+			return m_version;
+		}
+
+	protected:
+		/**
+		 * Derived classes must call this every time they modify their data
+		 */
+		void increment_version() {
+			++m_version;
+		}
+
+	private:
+		std::atomic<std::size_t> m_version;
 };
 
 } /* namespace data */
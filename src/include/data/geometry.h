@@ -3,8 +3,12 @@
  */
 #pragma once
 
+#include <map>
+#include <memory>
+#include <string>
 #include <Eigen/Core>
 
+#include <data/attribute.h>
 #include <data/data.h>
 #include <data/spacial.h>
 #include <types.h>
@@ -52,11 +56,69 @@ class Geometry : public Data {
 		 */
 		virtual Vec3 get_spacial_position(const Location& spacial_location) const = 0;
 
+		/**
+		 * No. of elements in a domain, i.e. no. of values an attribute of that domain must have.
+		 * Geometries having faces should override it.
+		 * @param a_domain attribute domain
+		 * @return no. of elements
+		 */
+		virtual std::size_t get_element_count(AttributeDomain a_domain) const {
+			return a_domain == AttributeDomain::VERTEX ? m_vertices.size() : 0;
+		}
+
+		/**
+		 * Adds an attribute channel, replacing any existing attribute with same name.
+		 * Attributes do not affect the shape of geometry, so they do not change its version.
+		 * @param a_name name of attribute
+		 * @param a_domain elements attribute values belong to
+		 * @param a_values one value per element of the domain
+		 * @return true if attribute was added else false
+		 */
+		template<typename ValueType>
+		bool add_attribute(const std::string& a_name, AttributeDomain a_domain, const std::vector<ValueType>& a_values) {
+			if (a_values.size() != get_element_count(a_domain)) {
+				return false;
+			}
+			m_attributes[a_name] = std::unique_ptr<AttributeChannelBase>(new AttributeChannel<ValueType>(a_domain, a_values));
+			return true;
+		}
+
+		/**
+		 * @param a_name name of attribute
+		 * @return attribute channel, or nullptr if there is no such attribute
+		 */
+		const AttributeChannelBase* get_attribute(const std::string& a_name) const {
+			auto found = m_attributes.find(a_name);
+			return found != m_attributes.end() ? found->second.get() : nullptr;
+		}
+
+		/**
+		 * @param a_name name of attribute
+		 * @return attribute channel, or nullptr if there is no such attribute of this type
+		 */
+		template<typename ValueType>
+		const AttributeChannel<ValueType>* get_attribute(const std::string& a_name) const {
+			return dynamic_cast<const AttributeChannel<ValueType>*>(get_attribute(a_name));
+		}
+
+		/**
+		 * @param a_name name of attribute
+		 * @return true if attribute existed
+		 */
+		bool remove_attribute(const std::string& a_name) {
+			return m_attributes.erase(a_name) > 0;
+		}
+
 	protected:
 		/**
 		 * Simple vector to store the vertex position data
 		 */
 		std::vector<Vec3> m_vertices;
+
+		/**
+		 * Attribute channels by name. Each channel stores its values contiguously.
+		 */
+		std::map<std::string, std::unique_ptr<AttributeChannelBase>> m_attributes;
 };
 
 } /* namespace data */
@@ -3,6 +3,8 @@
  */
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cmath>
 #include <vector>
 #include <math.h>
@@ -55,6 +57,119 @@ class PolygonMesh : public Geometry, public std::enable_shared_from_this<Polygon
 		 */
 		bool build_mesh(const std::vector<Vec3>& a_vertex_locations, const std::vector<Polygon>& a_topology);
 
+		/**
+		 * Adds polygons, and optionally new vertices, to the mesh. If the spacial index is up to date,
+		 * new polygons are inserted into it instead of rebuilding it.
+		 * @param a_vertex_locations	Vertices to append. They get indices starting at current vertex count.
+		 * @param a_topology			Polygons to append. They can refer to existing as well as appended vertices.
+		 * @returns true if polygons were added else false, in which case mesh is left unchanged.
+		 */
+		bool add_polygons(const std::vector<Vec3>& a_vertex_locations, const std::vector<Polygon>& a_topology);
+
+		/**
+		 * Removes polygons from the mesh. If the spacial index is up to date, removed polygons are removed from it
+		 * instead of rebuilding it.
+		 * Polygons are removed by moving the last polygon into the slot of removed one, so indices of
+		 * the polygons at the end of topology change. Vertices are left untouched.
+		 * @param a_polygon_indices Indices of polygons to remove
+		 * @returns true if polygons were removed else false, in which case mesh is left unchanged.
+		 */
+		bool remove_polygons(const std::vector<size_t>& a_polygon_indices);
+
+		/**
+		 * Incremental edits degrade quality of the spacial index compared to the one built with all the polygons
+		 * at once. Once no. of polygons added or removed since the last build exceeds this fraction
+		 * of polygon count at that build, the index is rebuilt from scratch on next query.
+		 * @param a_rebuild_ratio fraction of edited polygons triggering a rebuild
+		 */
+		void set_rebuild_ratio(float a_rebuild_ratio) {
+			m_rebuild_ratio = a_rebuild_ratio;
+		}
+
+		/**
+		 * Meshes with up to this many polygons are queried by scanning all of their polygons, a few at a time with
+		 * SIMD, instead of through the r-tree, which costs more than it saves for small meshes. Default was measured
+		 * with ClosestPointBenchmarks, which reports the crossover for the machine it runs on.
+		 * @param a_polygon_count max. no. of polygons to scan, 0 to always use the r-tree
+		 */
+		void set_brute_force_threshold(size_t a_polygon_count) {
+			if (a_polygon_count != m_brute_force_threshold) {
+				m_brute_force_threshold = a_polygon_count;
+				if (m_is_background_rebuild) {
+					// Readers must always find an index published
+					m_spacial_query_cache->rebuild(shared_from_this());
+				} else {
+					m_spacial_query_cache->invalidate();
+				}
+			}
+		}
+
+		size_t get_brute_force_threshold() const {
+			return m_brute_force_threshold;
+		}
+
+		/**
+		 * Default value of brute force threshold, see \ref set_brute_force_threshold
+		 */
+		static constexpr size_t DEFAULT_BRUTE_FORCE_THRESHOLD = 256;
+
+		/**
+		 * Checks if the spacial index reflects the current version of mesh.
+		 * @return false if next query will have to (re)build the index
+		 */
+		bool is_spacial_index_valid() const {
+			return m_spacial_query_cache->is_valid(*this);
+		}
+
+		/**
+		 * Makes mesh changes rebuild the spacial index in background, instead of on the next query.
+		 * Queries keep using the index, and the copy of polygons it carries, of the last version built
+		 * until the new one is published. This lets unfiltered queries run on other threads
+		 * while mesh is being changed, at the cost of answers lagging behind the mesh for a while.
+		 * Locations found that way may refer to polygons and vertices the mesh does not have anymore, use the
+		 * positions returned by the queries instead of \ref get_spacial_position when that matters.
+		 * Polygon edits rebuild the index from scratch in this mode, as updating it in place would race with
+		 * queries. A burst of edits costs one rebuild, rebuilds of versions already outdated are skipped.
+		 * Enabling it builds the index of the current version first, if required, so queries always find one.
+		 * Can be toggled while queries run, queries started before finish the way they started. Must be called
+		 * from the thread changing the mesh.
+		 * @param a_is_enabled true to rebuild in background
+		 */
+		void set_background_rebuild(bool a_is_enabled) {
+			if (a_is_enabled == m_is_background_rebuild) {
+				return;
+			}
+			if (a_is_enabled) {
+				m_spacial_query_cache->get_cached_data(shared_from_this());
+			} else {
+				// Index is updated in place again from now on, which background rebuilds must not be touching
+				m_spacial_query_cache->wait();
+			}
+			m_is_background_rebuild = a_is_enabled;
+		}
+
+		bool is_background_rebuild() const {
+			return m_is_background_rebuild;
+		}
+
+		/**
+		 * Waits until the spacial index is up to date with the mesh, building it if required.
+		 * Must be called from the thread changing the mesh.
+		 */
+		void wait_for_spacial_index() const {
+			m_spacial_query_cache->wait();
+			m_spacial_query_cache->get_cached_data(shared_from_this());
+		}
+
+		/**
+		 * Approximate no. of bytes held by the spacial index, waiting for it or building it if required.
+		 * Must be called from the thread changing the mesh.
+		 */
+		std::size_t get_spacial_index_memory_usage() const {
+			m_spacial_query_cache->wait();
+			return m_spacial_query_cache->get_cached_data(shared_from_this())->get_memory_usage();
+		}
+
 		/**
 		 * Given a point in same space as mesh, this function finds its closest point on the mesh.
 		 * We are using boost::geometry::r-tree as the acceleration structure. It stores bounding boxes
@@ -63,17 +178,134 @@ class PolygonMesh : public Geometry, public std::enable_shared_from_this<Polygon
 		 * @param a_query_point Point to query for
 		 * @return Spacial location of closest point.
 		 */
-		Location closest_point(const Vec3& a_query_point) const;
+		Location closest_point(const Vec3& a_query_point) const {
+			return closest_point(a_query_point, EXACT_QUERY);
+		}
+
+		/**
+		 * Approximate version of \ref closest_point. Polygons are visited in increasing order of distance of their
+		 * bounding volumes from the query point. Distance of the next bounding volume is a lower bound on the distance
+		 * of everything not visited yet, so we stop as soon as the closest point found is within the tolerance of it.
+		 * @param a_query_point Point to query for
+		 * @param a_tolerance Allowed error, \ref EXACT_QUERY for an exact answer
+		 * @param a_error_bound If not null, receives the error bound achieved
+		 * @param a_closest_position If not null, receives the position of the closest point, taken from the same
+		 * 							 version of the mesh the location was found on
+		 * @return Spacial location of closest point.
+		 */
+		Location closest_point(const Vec3& a_query_point,
+								const QueryTolerance& a_tolerance,
+								ErrorBound* a_error_bound = nullptr,
+								Vec3* a_closest_position = nullptr) const;
+
+		/**
+		 * Batch version of \ref closest_point. Query points are processed in parallel, all of them on the same
+		 * version of the spacial index.
+		 * @param a_query_points Points to query for
+		 * @param a_tolerance Allowed error, \ref EXACT_QUERY for exact answers
+		 * @param a_error_bounds If not null, receives the error bound achieved for each query point
+		 * @param a_closest_positions If not null, receives the position of the closest point for each query point
+		 * @return Spacial location of closest point, for each query point.
+		 */
+		std::vector<Location> closest_points(const std::vector<Vec3>& a_query_points,
+												const QueryTolerance& a_tolerance = EXACT_QUERY,
+												std::vector<ErrorBound>* a_error_bounds = nullptr,
+												std::vector<Vec3>* a_closest_positions = nullptr) const;
+
+		/**
+		 * Filtered version of \ref closest_point, only polygons whose mask has a bit in common with a_filter_mask
+		 * are considered. It uses a bounding volume hierarchy which stores, on every node, the bitwise OR of masks of
+		 * all the polygons under it, so subtrees without any matching polygon are skipped without visiting them.
+		 * The hierarchy is built on first filtered query. Unlike the r-tree it is not updated incrementally, any
+		 * change of polygons rebuilds it from scratch on the next filtered query. Mask changes only update the masks
+		 * on its nodes. Filtered queries can run on multiple threads at once.
+		 * @param a_query_point Point to query for
+		 * @param a_filter_mask Mask polygons are matched against
+		 * @param a_tolerance Allowed error, \ref EXACT_QUERY for an exact answer
+		 * @param a_error_bound If not null, receives the error bound achieved
+		 * @return Spacial location of closest matching point, or invalid location if no polygon matches.
+		 */
+		Location closest_point(const Vec3& a_query_point,
+								PolygonMask a_filter_mask,
+								const QueryTolerance& a_tolerance = EXACT_QUERY,
+								ErrorBound* a_error_bound = nullptr) const;
+
+		/**
+		 * Batch version of filtered \ref closest_point. Query points are processed in parallel.
+		 * @param a_query_points Points to query for
+		 * @param a_filter_mask Mask polygons are matched against
+		 * @param a_tolerance Allowed error, \ref EXACT_QUERY for exact answers
+		 * @param a_error_bounds If not null, receives the error bound achieved for each query point
+		 * @return Spacial location of closest matching point, for each query point.
+		 */
+		std::vector<Location> closest_points(const std::vector<Vec3>& a_query_points,
+												PolygonMask a_filter_mask,
+												const QueryTolerance& a_tolerance = EXACT_QUERY,
+												std::vector<ErrorBound>* a_error_bounds = nullptr) const;
+
+		/**
+		 * Finds closest points between a capsule, or a segment or swept sphere, and the mesh in a single traversal of
+		 * the bounding volume hierarchy used by filtered queries. Nodes are visited in increasing order of their
+		 * distance from the segment, and the traversal stops once the next one is farther than the closest polygon.
+		 * @param a_capsule Capsule to query for, radius 0 for a segment
+		 * @param a_filter_mask Mask polygons are matched against
+		 * @return Closest points on mesh and segment, and distance between mesh and capsule,
+		 * 		   or invalid location if no polygon matches.
+		 */
+		SegmentLocation closest_point(const Capsule& a_capsule, PolygonMask a_filter_mask = ALL_POLYGONS_MASK) const;
+
+		/**
+		 * Batch version of capsule \ref closest_point. Capsules are processed in parallel.
+		 * @param a_capsules Capsules to query for
+		 * @param a_filter_mask Mask polygons are matched against
+		 * @return Closest points and distance, for each capsule.
+		 */
+		std::vector<SegmentLocation> closest_points(const std::vector<Capsule>& a_capsules,
+													PolygonMask a_filter_mask = ALL_POLYGONS_MASK) const;
+
+		/**
+		 * Sets masks of all the polygons. Polygons get \ref ALL_POLYGONS_MASK when mesh is built or polygons are added.
+		 * @param a_polygon_masks one mask per polygon
+		 * @return true if masks were set else false
+		 */
+		bool set_polygon_masks(const std::vector<PolygonMask>& a_polygon_masks);
+
+		/**
+		 * @param index polygon index
+		 * @return mask of the polygon
+		 */
+		PolygonMask get_polygon_mask(size_t index) const {
+			return index < m_polygon_masks.size() ? m_polygon_masks[index] : 0;
+		}
 
 		/**
 		 * Gets vertex position(x,y,z) given spacial location.
 		 * It uses barycentric coordinates and vertex positions of the triangle
 		 * this spacial_location object represents to calculate object space vertex coord.
 		 * @param spacial_location Spacial location of the point
-		 * @return Vertex positions in (x,y,z) coord. form
+		 * @return Vertex positions in (x,y,z) coord. form. Zero for invalid locations, and for locations referring
+		 * 		   to vertices the mesh does not have, which queries in background rebuild mode can return.
 		 */
 		Vec3 get_spacial_position(const Location& spacial_location) const override;
 
+		/**
+		 * Batch evaluation of locations. Positions, unit normals and requested attributes are evaluated for all
+		 * the locations and written to caller provided Structure of Arrays buffers. Blocks of locations are evaluated
+		 * in parallel, each unpacked into a \ref LocationBlock first, so that every output array is then filled by
+		 * its own loop without branches.
+		 * Normals are interpolated from \ref NORMAL_ATTRIBUTE if mesh has it as a per-vertex Vec3 attribute,
+		 * else they are the polygon normals. Invalid locations, and those referring to vertices or polygons the mesh
+		 * does not have, evaluate to zero.
+		 * @param a_locations Spacial locations to evaluate
+		 * @param a_buffers Buffers to write to, each with room for a value per location
+		 * @return false if a requested attribute does not exist or has different no. of components than buffers given
+		 */
+		bool evaluate(const std::vector<Location>& a_locations, const EvaluationBuffers& a_buffers) const;
+
+		size_t get_element_count(AttributeDomain a_domain) const override {
+			return a_domain == AttributeDomain::FACE ? m_topology.size() : m_vertices.size();
+		}
+
 		/**
 		 * Gets the no. of polygons this polygon mesh has.
 		 * @return Polygon count
@@ -95,6 +327,13 @@ class PolygonMesh : public Geometry, public std::enable_shared_from_this<Polygon
 			}
 		}
 
+		/**
+		 * Computes the bounding volume of a polygon
+		 * @param index polygon index
+		 * @return Bounding volume of vertices of the polygon
+		 */
+		BoundingVolume get_polygon_bounds(size_t index) const;
+
 		// factory function that creates shared ptr for Polygonmesh
 		/**
 		 * Creates a shared pointer for this, required for enable_shared_from_this
@@ -113,7 +352,11 @@ class PolygonMesh : public Geometry, public std::enable_shared_from_this<Polygon
 		 */
 		PolygonMesh()
 				: 	Geometry()
-				,	m_spacial_query_cache(std::make_shared<Cache<SpacialQueryCacheData>>()) {
+				,	m_spacial_query_cache(std::make_shared<SnapshotCache<SpacialQueryCacheData>>())
+				,	m_hierarchy_cache(std::make_shared<Cache<HierarchyCacheData>>())
+				,	m_rebuild_ratio(DEFAULT_REBUILD_RATIO)
+				,	m_is_background_rebuild(false)
+				,	m_brute_force_threshold(DEFAULT_BRUTE_FORCE_THRESHOLD) {
 		};
 
 		/**
@@ -128,16 +371,24 @@ class PolygonMesh : public Geometry, public std::enable_shared_from_this<Polygon
 		 */
 		std::vector<Polygon> m_topology;
 
+		/**
+		 * Mask of each polygon, used by filtered queries
+		 */
+		std::vector<PolygonMask> m_polygon_masks;
+
 		/**
 		 * We are using a r-tree data structure to speedup our closest-point to mesh queries.
-		 * SpacialQueryCacheData contains this tree as cached object
+		 * SpacialQueryCacheData contains this tree as cached object, along with a copy of polygons it was built from.
+		 * Queries only look at the copy, so they can run while mesh is being changed.
 		 */
-		class SpacialQueryCacheData : CacheData {
+		class SpacialQueryCacheData : public CacheData {
 			public:
-				SpacialQueryCacheData(std::shared_ptr<const Data> a_data)
-						: 	CacheData(a_data),
-							m_polygon_tree(nullptr) {
-				}
+				/**
+				 * Copies polygons of the mesh, r-tree is built from the copy by \ref compute.
+				 * Meshes up to brute force threshold get packed polygons to scan instead of an r-tree.
+				 * Mesh is not referred to after that, so that the mesh owning this cache can be freed.
+				 */
+				SpacialQueryCacheData(std::shared_ptr<const Data> a_data);
 				/**
 				 * Aliasing for readability.
 				 * We are using quadratic<16> as the desired algorithm for loading data.
@@ -149,10 +400,30 @@ class PolygonMesh : public Geometry, public std::enable_shared_from_this<Polygon
 				using SpacialCachePolygonTree = rtree<PolygonIndexPair, quadratic<16>>;
 
 				/**
-				 * Computes r-tree cache for repeated closest point queries
+				 * Computes r-tree cache, or packed polygons, for repeated closest point queries
 				 */
 				void compute() override;
 
+				/**
+				 * Memory held by the copy of polygons, and by the r-tree leaves or packed polygons, whichever was built
+				 */
+				std::size_t get_memory_usage() const override;
+
+				/**
+				 * Checks if queries should scan all the polygons instead of using the r-tree, which is not built then
+				 */
+				bool is_brute_force() const {
+					return m_is_brute_force;
+				}
+
+				/**
+				 * Finds closest point by checking every polygon
+				 * @param a_query_point Point to query for
+				 * @param a_distance receives distance of closest point from query point
+				 * @return location of closest point, or invalid location if there are no polygons
+				 */
+				Location scan_closest_point(const Vec3& a_query_point, float& a_distance) const;
+
 				/**
 				 * Returns unique_prt to r-tree cache. We don't want to share ownership of cache.
 				 * @return unique pointer to r-tree cache
@@ -161,24 +432,300 @@ class PolygonMesh : public Geometry, public std::enable_shared_from_this<Polygon
 					return m_polygon_tree;
 				}
 
+				/**
+				 * Copies a polygon from the mesh and inserts it into the r-tree
+				 * @param a_mesh mesh this index was built from
+				 * @param a_polygon_index index of polygon, already present in the mesh
+				 */
+				void insert(const PolygonMesh& a_mesh, size_t a_polygon_index);
+
+				/**
+				 * Removes a polygon from the r-tree. Copy of the polygon is dropped if it is the last one.
+				 * @param a_polygon_index index of polygon
+				 */
+				void remove(size_t a_polygon_index);
+
+				/**
+				 * Evaluates closest point on a polygon, as it was when copied
+				 * @param a_polygon_index index of polygon
+				 * @param a_query_point Point to query for
+				 * @param a_distance receives distance of closest point from query point
+				 * @return location of closest point on the polygon
+				 */
+				Location get_closest_point_on_polygon(size_t a_polygon_index, const Vec3& a_query_point, float& a_distance) const;
+
+				/**
+				 * Position of a location on the copied polygons
+				 * @param a_location location found on this index
+				 */
+				Vec3 get_position(const Location& a_location) const;
+
+				/**
+				 * No. of polygons inserted or removed since the r-tree was computed
+				 */
+				size_t get_edit_count() const {
+					return m_edit_count;
+				}
+
+				/**
+				 * No. of polygons r-tree was computed with
+				 */
+				size_t get_built_polygon_count() const {
+					return m_built_polygon_count;
+				}
+
 			private:
+				/**
+				 * No. of polygons scanned together. Temporaries of a block live on stack.
+				 */
+				static constexpr int SCAN_BLOCK_SIZE = 16;
+
+				/**
+				 * Coordinates of a vector, one array per coordinate, one entry per polygon
+				 */
+				using PackedVectors = std::array<Eigen::ArrayXf, 3>;
+
+				/**
+				 * Polygons packed as Structure of Arrays, along with what distance computation needs of them,
+				 * so that scanning them vectorizes. For a triangle [a, b, c] with normal n
+				 * - vertices		: a, b and c
+				 * - sides			: b - a, c - b and a - c
+				 * - side_normals	: normals of sides in triangle plane, pointing inside, n x side
+				 * - inverse_squared_side_lengths	: inverse squared lengths of sides, 0 for zero length
+				 * - normal, inverse_squared_normal_length	: n, and its inverse squared length, 0 for zero area
+				 * - has_area		: 1 for triangles with area, 0 for the ones which are a line or a point
+				 */
+				struct PackedPolygons {
+						std::array<PackedVectors, 3> vertices;
+						std::array<PackedVectors, 3> sides;
+						std::array<PackedVectors, 3> side_normals;
+						std::array<Eigen::ArrayXf, 3> inverse_squared_side_lengths;
+						PackedVectors normal;
+						Eigen::ArrayXf inverse_squared_normal_length;
+						Eigen::ArrayXf has_area;
+				};
+
+				/**
+				 * Bounding volume of a copied polygon
+				 */
+				BoundingVolume get_polygon_bounds(size_t a_polygon_index) const;
+
+				/**
+				 * Packs copied polygons for scanning
+				 */
+				void pack_polygons();
+
+				/**
+				 * See \ref is_brute_force
+				 */
+				bool m_is_brute_force;
+
+				/**
+				 * Packed polygons, only when \ref m_is_brute_force
+				 */
+				PackedPolygons m_packed_polygons;
+
 				/**
 				 * Unique pointert to r-tree cache object
 				 */
 				std::unique_ptr<SpacialCachePolygonTree> m_polygon_tree;
+
+				/**
+				 * Copy of mesh topology
+				 */
+				std::vector<Polygon> m_polygons;
+
+				/**
+				 * Corner positions of copied polygons, three per polygon
+				 */
+				std::vector<Vec3> m_corners;
+
+				size_t m_built_polygon_count;
+
+				size_t m_edit_count;
+		};
+
+		/**
+		 * Bounding volume hierarchy over polygons, with the masks of polygons OR'ed together on every node.
+		 * Unlike the r-tree, we own the nodes here, which lets us carry masks on them and walk them in any order.
+		 * Nodes are stored flat, children of an internal node are next to each other.
+		 */
+		class HierarchyCacheData : public CacheData {
+			public:
+				/**
+				 * A node of the hierarchy
+				 * - bounds		: bounding volume of all the polygons under the node
+				 * - mask		: bitwise OR of masks of all the polygons under the node
+				 * - count		: no. of polygons for a leaf, 0 for an internal node
+				 * - offset		: first entry in \ref m_polygon_indices for a leaf, first child for an internal node
+				 */
+				struct Node {
+						BoundingVolume bounds;
+						PolygonMask mask;
+						std::uint32_t count;
+						size_t offset;
+				};
+
+				HierarchyCacheData(std::shared_ptr<const Data> a_data)
+						: 	CacheData(nullptr),
+							m_mesh(dynamic_cast<const PolygonMesh*>(a_data.get())) {
+					// Mesh owns this cache, holding on to it here would keep the mesh alive forever
+					set_data_version(a_data->get_version());
+				}
+
+				/**
+				 * Builds the hierarchy by splitting polygons at the median of their centroids along the longest axis
+				 */
+				void compute() override;
+
+				/**
+				 * Takes masks of polygons from the mesh again and aggregates them up the hierarchy, without
+				 * rebuilding it. Only valid as long as polygons of the mesh are the ones hierarchy was built with.
+				 * @param a_mesh mesh hierarchy was built from
+				 */
+				void update_masks(const PolygonMesh& a_mesh);
+
+				/**
+				 * Visits polygons matching a mask, in increasing order of distance of their nodes.
+				 * Nodes not matching the mask are skipped along with everything under them.
+				 * @param a_filter_mask Mask polygons are matched against
+				 * @param a_node_distance Callable giving a lower bound of distance to everything inside a bounding volume
+				 * @param a_is_done Callable told the lower bound of distance of everything not visited yet,
+				 * 					returning true to stop the traversal
+				 * @param a_visit_polygon Callable visiting a polygon index
+				 * @return Lower bound of distance of polygons not visited, or infinity if everything was visited
+				 */
+				template<typename NodeDistance, typename IsDone, typename VisitPolygon>
+				float traverse(PolygonMask a_filter_mask,
+								NodeDistance a_node_distance,
+								IsDone a_is_done,
+								VisitPolygon a_visit_polygon) const;
+
+			private:
+				/**
+				 * Builds the node, and nodes under it, for polygons in [a_begin, a_end) of \ref m_polygon_indices
+				 * @param a_polygon_bounds bounding volumes of polygons
+				 * @param a_node_index index of node, already added to \ref m_nodes
+				 */
+				void build(const std::vector<BoundingVolume>& a_polygon_bounds, size_t a_begin, size_t a_end, size_t a_node_index);
+
+				/**
+				 * Nodes, first one is the root
+				 */
+				std::vector<Node> m_nodes;
+
+				/**
+				 * Polygon indices, ordered so that each leaf refers to a contiguous range
+				 */
+				std::vector<size_t> m_polygon_indices;
+
+				/**
+				 * Masks in the same order as \ref m_polygon_indices, so that leaves do not have to go back to mesh
+				 */
+				std::vector<PolygonMask> m_polygon_masks;
+
+				/**
+				 * Mesh the hierarchy is built from, which owns it
+				 */
+				const PolygonMesh* m_mesh;
 		};
 
+		/**
+		 * Searches r-tree for closest point, as described in \ref closest_point
+		 * @param a_spacial_index spacial index to search, see \ref get_spacial_index
+		 * @param a_query_point Point to query for
+		 * @param a_tolerance Allowed error
+		 * @param a_error_bound Receives the error bound achieved
+		 * @param a_closest_position If not null, receives the position of the closest point
+		 * @return Spacial location of closest point, or invalid location if mesh has no polygons
+		 */
+		Location search_polygon_tree(const SpacialQueryCacheData& a_spacial_index,
+										const Vec3& a_query_point,
+										const QueryTolerance& a_tolerance,
+										ErrorBound& a_error_bound,
+										Vec3* a_closest_position) const;
+
+		/**
+		 * Searches the hierarchy for closest point, as described in filtered \ref closest_point
+		 * @param a_hierarchy hierarchy of this mesh, up to date
+		 */
+		Location search_hierarchy(const HierarchyCacheData& a_hierarchy,
+									const Vec3& a_query_point,
+									PolygonMask a_filter_mask,
+									const QueryTolerance& a_tolerance,
+									ErrorBound* a_error_bound) const;
+
+		/**
+		 * Searches the hierarchy for closest points, as described in capsule \ref closest_point
+		 * @param a_hierarchy hierarchy of this mesh, up to date
+		 */
+		SegmentLocation search_hierarchy(const HierarchyCacheData& a_hierarchy,
+											const Capsule& a_capsule,
+											PolygonMask a_filter_mask) const;
+
+		/**
+		 * Evaluates closest point on a polygon
+		 * @param a_polygon_index index of polygon
+		 * @param a_query_point Point to query for
+		 * @param a_distance receives distance of closest point from query point
+		 * @return location of closest point on the polygon
+		 */
+		Location get_closest_point_on_polygon(size_t a_polygon_index, const Vec3& a_query_point, float& a_distance) const;
+
+		/**
+		 * Returns the spacial index if it can be updated incrementally for the edit which is about to happen,
+		 * else invalidates it so that it is rebuilt by next query.
+		 * Must be called before the mesh is modified.
+		 * @param a_edit_count no. of polygons which will be inserted or removed
+		 * @return spacial index to update, or nullptr
+		 */
+		SpacialQueryCacheData* get_spacial_index_for_edit(size_t a_edit_count);
+
+		/**
+		 * Returns the spacial index to query. In background rebuild mode that is the last published one, kept alive
+		 * by a_snapshot till caller is done with it, else the one up to date with the mesh, built if required.
+		 * @param a_snapshot receives the snapshot in background rebuild mode
+		 * @return spacial index, or nullptr if none was published
+		 */
+		const SpacialQueryCacheData* get_spacial_index(std::shared_ptr<const SpacialQueryCacheData>& a_snapshot) const;
+
 		/**
 		 * Cached data handler of r-tree acceleration structure for PolygonMesh's closest point query.
 		 * Since cache can mutate in functions like \ref PolygonMesh::closest_point
 		 * we make it mutable. const_cast'ing it at requirement could be another way of doing this.
 		 */
-		mutable std::shared_ptr<Cache<SpacialQueryCacheData>> m_spacial_query_cache;
+		mutable std::shared_ptr<SnapshotCache<SpacialQueryCacheData>> m_spacial_query_cache;
 
 		/**
-		 * No. of closest triangles to fetch from the acceleration structure
+		 * Cached data handler of bounding volume hierarchy used by filtered queries
+		 */
+		mutable std::shared_ptr<Cache<HierarchyCacheData>> m_hierarchy_cache;
+
+		/**
+		 * No. of closest triangles to fetch from the acceleration structure at first.
+		 * If it is not enough to find the closest point, we fetch twice as many, and so on.
 		 */
 		const std::size_t CLOSEST_TRIANGLE_COUNT = 16;
+
+		/**
+		 * Default value of \ref m_rebuild_ratio
+		 */
+		static constexpr float DEFAULT_REBUILD_RATIO = 0.25f;
+
+		/**
+		 * Fraction of polygons edited incrementally, after which spacial index is rebuilt
+		 */
+		float m_rebuild_ratio;
+
+		/**
+		 * See \ref set_background_rebuild. Queries read it on other threads.
+		 */
+		std::atomic<bool> m_is_background_rebuild;
+
+		/**
+		 * See \ref set_brute_force_threshold
+		 */
+		size_t m_brute_force_threshold;
 };
 
 } /* namespace data */
@@ -5,7 +5,9 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 
 #include <data/math.h>
 #include <types.h>
@@ -35,6 +37,57 @@ struct Location {
  */
 static const Location INVALID_LOCATION { Vec3ui(), 0, Vec3(), false };
 
+/**
+ * 32-bit mask tagging a polygon with the groups (materials, parts, selection sets etc.) it belongs to,
+ * one bit per group. A polygon matches a filter mask if they have at least one bit in common.
+ */
+using PolygonMask = std::uint32_t;
+
+/**
+ * Mask matching all the polygons. It is also the mask polygons have unless told otherwise.
+ */
+static const PolygonMask ALL_POLYGONS_MASK = 0xFFFFFFFFu;
+
+/**
+ * Tolerance for approximate closest point queries. Query may stop as soon as the closest point it has found
+ * is provably within (1 + relative_epsilon) times the true closest distance,
+ * or within absolute_epsilon of the true closest distance. Both zero means an exact query.
+ */
+struct QueryTolerance {
+		float relative_epsilon;		// Allowed error relative to true closest distance
+		float absolute_epsilon;		// Allowed error in distance units
+};
+
+/**
+ * Const to represent an exact query
+ */
+static const QueryTolerance EXACT_QUERY { 0.0f, 0.0f };
+
+/**
+ * Error bound achieved by a closest point query.
+ * True closest distance lies in [lower_bound, distance].
+ * - distance		: Distance from query point to the point found
+ * - lower_bound	: Proven lower bound on the distance to the true closest point
+ */
+struct ErrorBound {
+		float distance;				// Distance to the point found
+		float lower_bound;			// Lower bound on distance to the true closest point
+
+		/**
+		 * @return Max. difference between distance found and true closest distance
+		 */
+		float absolute_error() const {
+			return distance - lower_bound;
+		}
+
+		/**
+		 * @return Max. ratio of distance found over true closest distance, minus one
+		 */
+		float relative_error() const {
+			return lower_bound > 0.0f ? distance / lower_bound - 1.0f : (distance > 0.0f ? std::numeric_limits<float>::infinity() : 0.0f);
+		}
+};
+
 /**
  * This function tries to project a point on a triangle plane and
  * returns the barycentric coordinates of the projected point.
@@ -71,16 +124,12 @@ inline Vec3 get_barycentric_coords(const Vec3& a_vertex1,
 /**
  * ###This function finds closest point on a triangle given a query point.
  *
- * We first find barycentric coords.(BCs) of projection of query point on triangle plane.
- * If all the BCs are positive, it means projected point(PP) is inside the triangle,
- * hence this is the closest point on triangle to the query point.
- * Else projected point is outside the triangle and hence closest point can be on an edge or on one of the vertex.
- * Let's say our triangle has vertices [a, b, c], if let's say BC.x is negative,
- * it would mean projected point is beyond the edge opposite to first vertex(a) of triangle.
- * Hence closest projected point can be either on edge b-c or on b or c.
- * We re-project(RP) the projected point(PP) on to the edge b-c and then find ratio of it's distance from b and c.
- * This would give us good estimate of where the closest point lies. If the latest projected point(RP) is not between
- * b and c but on an extended line b-c, we clamp it to b or c depending on which side it is.
+ * We classify the query point against the Voronoi regions of the triangle's vertices, edges and face.
+ * Let's say our triangle has vertices [a, b, c]. If the query point projects outside the triangle behind a vertex,
+ * say a, on both edges a-b and a-c, then a itself is the closest point. Else if it projects outside an edge, say a-b,
+ * between its end points, the closest point is its projection on that edge. Otherwise the projection of the query
+ * point on the triangle plane is inside the triangle and it is the closest point.
+ * Implementation follows "Real-Time Collision Detection" by Christer Ericson, section 5.1.5.
  *
  * @param a_vertex1 1st vertex of triangle
  * @param a_vertex2 2st vertex of triangle
@@ -92,53 +141,289 @@ inline Vec3 get_closest_point_on_triangle(const Vec3& a_vertex1,
 											const Vec3& a_vertex2,
 											const Vec3& a_vertex3,
 											const Vec3& a_query_point) {
+	const Vec3 side1 = a_vertex2 - a_vertex1;
+	const Vec3 side2 = a_vertex3 - a_vertex1;
+
+	// Vertex region of a
+	const Vec3 vertex1_query = a_query_point - a_vertex1;
+	const float d1 = side1.dot(vertex1_query);
+	const float d2 = side2.dot(vertex1_query);
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		return Vec3(1.0f, 0.0f, 0.0f);
+	}
+
+	// Vertex region of b
+	const Vec3 vertex2_query = a_query_point - a_vertex2;
+	const float d3 = side1.dot(vertex2_query);
+	const float d4 = side2.dot(vertex2_query);
+	if (d3 >= 0.0f && d4 <= d3) {
+		return Vec3(0.0f, 1.0f, 0.0f);
+	}
 
-	// A minor optimisation to return if the query point is coinciding with any of the triangle vertex
-	if (a_query_point == a_vertex1 || a_query_point == a_vertex2 || a_query_point == a_vertex3) {
-		return a_query_point;
+	// Edge region of a-b
+	const float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		const float v = d1 / (d1 - d3);
+		return Vec3(1.0f - v, v, 0.0f);
 	}
 
-	// Get the BC of the projected point
-	Vec3 barycentric_coord = get_barycentric_coords(a_vertex1, a_vertex2, a_vertex3, a_query_point);
+	// Vertex region of c
+	const Vec3 vertex3_query = a_query_point - a_vertex3;
+	const float d5 = side1.dot(vertex3_query);
+	const float d6 = side2.dot(vertex3_query);
+	if (d6 >= 0.0f && d5 <= d6) {
+		return Vec3(0.0f, 0.0f, 1.0f);
+	}
 
-	bool u_is_negative = std::signbit(barycentric_coord.x());
-	bool v_is_negative = std::signbit(barycentric_coord.y());
-	bool w_is_negative = std::signbit(barycentric_coord.z());
+	// Edge region of a-c
+	const float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		const float w = d2 / (d2 - d6);
+		return Vec3(1.0f - w, 0.0f, w);
+	}
 
-	// If none of the barycentric coords. are negative, we got our point
-	if (!u_is_negative && !v_is_negative && !w_is_negative && barycentric_coord.sum() == 1.0f) {
-		return barycentric_coord;
+	// Edge region of b-c
+	const float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		const float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		return Vec3(0.0f, 1.0f - w, w);
 	}
 
-	// Else the projection of point is outside the triangle
-	// We now try to find the closest point either on edge or on vertex itself.
-	if (u_is_negative) {
-		// Point either lies on edge b-c or on b or c
-		Vec3 vertex2_query = a_query_point - a_vertex2;
-		Vec3 side2 = a_vertex3 - a_vertex2;
-		float projected_dist = vertex2_query.dot(side2) / side2.squaredNorm();
-		barycentric_coord.x() = 0.0f;
-		barycentric_coord.z() = clamp(projected_dist, 0.0f, 1.0f);
-		barycentric_coord.y() = 1.0f - barycentric_coord.z();
-	} else if (v_is_negative) {
-		// Point either lies on edge c-a or on a or c
-		Vec3 vertex3_query = a_query_point - a_vertex3;
-		Vec3 side3 = a_vertex1 - a_vertex3;
-		float projected_dist = vertex3_query.dot(side3) / side3.squaredNorm();
-		barycentric_coord.x() = clamp(projected_dist, 0.0f, 1.0f);
-		barycentric_coord.y() = 0.0f;
-		barycentric_coord.z() = 1.0f - barycentric_coord.x();
+	// Face region
+	const float denominator = 1.0f / (va + vb + vc);
+	const float v = vb * denominator;
+	const float w = vc * denominator;
+	return Vec3(1.0f - v - w, v, w);
+}
+
+/**
+ * Capsule, all the points within radius of a segment. A sphere of that radius swept along the segment
+ * covers exactly this capsule, and a segment is a capsule of radius 0.
+ */
+struct Capsule {
+		Vec3 start;			// Start of the segment
+		Vec3 end;			// End of the segment
+		float radius;		// Radius around the segment
+};
+
+/**
+ * Result of a closest point query for a segment or capsule
+ * - location	: Closest point on the mesh
+ * - parameter	: Closest point on the segment, 0 at its start and 1 at its end
+ * - distance	: Distance between the mesh and the capsule, negative if they overlap
+ */
+struct SegmentLocation {
+		Location location;		// Closest point on the mesh
+		float parameter;		// Closest point on the segment
+		float distance;			// Distance between mesh and capsule
+};
+
+/**
+ * Const to represent an invalid segment location
+ */
+static const SegmentLocation INVALID_SEGMENT_LOCATION { { Vec3ui::Zero(), 0, Vec3::Zero(), false },
+														0.0f,
+														std::numeric_limits<float>::max() };
+
+/**
+ * Finds closest points between two segments.
+ * Implementation follows "Real-Time Collision Detection" by Christer Ericson, section 5.1.9.
+ *
+ * @param a_start1 start of first segment
+ * @param a_end1 end of first segment
+ * @param a_start2 start of second segment
+ * @param a_end2 end of second segment
+ * @param a_parameter1 receives closest point on first segment, 0 at its start and 1 at its end
+ * @param a_parameter2 receives closest point on second segment, 0 at its start and 1 at its end
+ * @return Squared distance between closest points
+ */
+inline float get_closest_points_on_segments(const Vec3& a_start1,
+											const Vec3& a_end1,
+											const Vec3& a_start2,
+											const Vec3& a_end2,
+											float& a_parameter1,
+											float& a_parameter2) {
+	const Vec3 direction1 = a_end1 - a_start1;
+	const Vec3 direction2 = a_end2 - a_start2;
+	const Vec3 start2_start1 = a_start1 - a_start2;
+	const float squared_length1 = direction1.squaredNorm();
+	const float squared_length2 = direction2.squaredNorm();
+	const float f = direction2.dot(start2_start1);
+
+	if (squared_length1 <= 0.0f && squared_length2 <= 0.0f) {
+		// Both segments are points
+		a_parameter1 = 0.0f;
+		a_parameter2 = 0.0f;
+	} else if (squared_length1 <= 0.0f) {
+		// First segment is a point
+		a_parameter1 = 0.0f;
+		a_parameter2 = clamp(f / squared_length2, 0.0f, 1.0f);
 	} else {
-		// Point either lies on edge a-b or on a or b
-		Vec3 vertex1_query = a_query_point - a_vertex1;
-		Vec3 side1 = a_vertex2 - a_vertex1;
-		float projected_dist = vertex1_query.dot(side1) / side1.squaredNorm();
-		barycentric_coord.y() = clamp(projected_dist, 0.0f, 1.0f);
-		barycentric_coord.x() = 1.0f - barycentric_coord.y();
-		barycentric_coord.z() = 0.0f;
+		const float c = direction1.dot(start2_start1);
+		if (squared_length2 <= 0.0f) {
+			// Second segment is a point
+			a_parameter2 = 0.0f;
+			a_parameter1 = clamp(-c / squared_length1, 0.0f, 1.0f);
+		} else {
+			const float b = direction1.dot(direction2);
+			const float denominator = squared_length1 * squared_length2 - b * b;
+			// Parallel segments have no single closest pair, any one of them will do
+			a_parameter1 = denominator != 0.0f ? clamp((b * f - c * squared_length2) / denominator, 0.0f, 1.0f) : 0.0f;
+			a_parameter2 = (b * a_parameter1 + f) / squared_length2;
+			if (a_parameter2 < 0.0f) {
+				a_parameter2 = 0.0f;
+				a_parameter1 = clamp(-c / squared_length1, 0.0f, 1.0f);
+			} else if (a_parameter2 > 1.0f) {
+				a_parameter2 = 1.0f;
+				a_parameter1 = clamp((b - c) / squared_length1, 0.0f, 1.0f);
+			}
+		}
+	}
+	return ((a_start1 + direction1 * a_parameter1) - (a_start2 + direction2 * a_parameter2)).squaredNorm();
+}
+
+/**
+ * Finds closest points between a segment and a triangle.
+ * If the segment crosses the triangle they touch where it crosses, else one of the closest points
+ * is an end point of the segment or lies on an edge of the triangle, so we check all of those.
+ *
+ * @param a_start start of segment
+ * @param a_end end of segment
+ * @param a_vertex1 1st vertex of triangle
+ * @param a_vertex2 2nd vertex of triangle
+ * @param a_vertex3 3rd vertex of triangle
+ * @param a_parameter receives closest point on segment, 0 at its start and 1 at its end
+ * @param a_barycentric_coords receives barycentric coordinates of closest point on triangle
+ * @return Squared distance between closest points
+ */
+inline float get_closest_points_on_segment_triangle(const Vec3& a_start,
+													const Vec3& a_end,
+													const Vec3& a_vertex1,
+													const Vec3& a_vertex2,
+													const Vec3& a_vertex3,
+													float& a_parameter,
+													Vec3& a_barycentric_coords) {
+	const Vec3 direction = a_end - a_start;
+	const Vec3 side1 = a_vertex2 - a_vertex1;
+	const Vec3 side2 = a_vertex3 - a_vertex1;
+
+	// Segment crossing the triangle, Moeller-Trumbore intersection test
+	const Vec3 direction_side2 = direction.cross(side2);
+	const float determinant = side1.dot(direction_side2);
+	if (determinant != 0.0f) {
+		const float inverse_determinant = 1.0f / determinant;
+		const Vec3 vertex1_start = a_start - a_vertex1;
+		const float v = vertex1_start.dot(direction_side2) * inverse_determinant;
+		const Vec3 start_side1 = vertex1_start.cross(side1);
+		const float w = direction.dot(start_side1) * inverse_determinant;
+		const float t = side2.dot(start_side1) * inverse_determinant;
+		if (v >= 0.0f && w >= 0.0f && v + w <= 1.0f && t >= 0.0f && t <= 1.0f) {
+			a_parameter = t;
+			a_barycentric_coords = Vec3(1.0f - v - w, v, w);
+			return 0.0f;
+		}
+	}
+
+	float min_squared_distance = std::numeric_limits<float>::max();
+	auto check_end_point = [&](const Vec3& a_point, float a_point_parameter) {
+		const Vec3 barycentric_coords = get_closest_point_on_triangle(a_vertex1, a_vertex2, a_vertex3, a_point);
+		const Vec3 closest_point = a_vertex1 * barycentric_coords.x() + a_vertex2 * barycentric_coords.y()
+				+ a_vertex3 * barycentric_coords.z();
+		const float squared_distance = (closest_point - a_point).squaredNorm();
+		if (squared_distance < min_squared_distance) {
+			min_squared_distance = squared_distance;
+			a_parameter = a_point_parameter;
+			a_barycentric_coords = barycentric_coords;
+		}
+	};
+	check_end_point(a_start, 0.0f);
+	check_end_point(a_end, 1.0f);
+
+	// Edges, along with the barycentric coordinates of their end points
+	const std::array<std::array<int, 2>, 3> edges = { { { { 0, 1 } }, { { 1, 2 } }, { { 2, 0 } } } };
+	const std::array<const Vec3*, 3> vertices = { { &a_vertex1, &a_vertex2, &a_vertex3 } };
+	for (const std::array<int, 2>& edge : edges) {
+		float segment_parameter = 0.0f;
+		float edge_parameter = 0.0f;
+		const float squared_distance = get_closest_points_on_segments(a_start,
+																		a_end,
+																		*vertices[edge[0]],
+																		*vertices[edge[1]],
+																		segment_parameter,
+																		edge_parameter);
+		if (squared_distance < min_squared_distance) {
+			min_squared_distance = squared_distance;
+			a_parameter = segment_parameter;
+			a_barycentric_coords = Vec3::Zero();
+			a_barycentric_coords[edge[0]] = 1.0f - edge_parameter;
+			a_barycentric_coords[edge[1]] = edge_parameter;
+		}
+	}
+	return min_squared_distance;
+}
+
+/**
+ * Finds squared distance between a segment and a box.
+ * Planes of the box faces split the segment into at most 7 pieces. Along each one, every coordinate of the segment
+ * stays either inside the box or outside on the same side, so squared distance to the box is a quadratic,
+ * minimum of which is easy to find.
+ *
+ * @param a_start start of segment
+ * @param a_end end of segment
+ * @param a_box box
+ * @return Squared distance between segment and box, 0 if segment touches the box
+ */
+inline float get_squared_distance_segment_box(const Vec3& a_start, const Vec3& a_end, const BoundingVolume& a_box) {
+	const Vec3 direction = a_end - a_start;
+	std::array<float, 8> splits;
+	size_t split_count = 0;
+	splits[split_count++] = 0.0f;
+	splits[split_count++] = 1.0f;
+	for (int axis = 0; axis < 3; ++axis) {
+		if (direction[axis] == 0.0f) {
+			continue;
+		}
+		for (const float bound : { a_box.min()[axis], a_box.max()[axis] }) {
+			const float parameter = (bound - a_start[axis]) / direction[axis];
+			if (parameter > 0.0f && parameter < 1.0f) {
+				// Insertion sort, splits are few
+				size_t index = split_count++;
+				for (; splits[index - 1] > parameter; --index) {
+					splits[index] = splits[index - 1];
+				}
+				splits[index] = parameter;
+			}
+		}
 	}
 
-	return barycentric_coord;
+	float min_squared_distance = std::numeric_limits<float>::max();
+	for (size_t index = 0; index + 1 < split_count; ++index) {
+		const float piece_start = splits[index];
+		const float piece_end = splits[index + 1];
+		const Vec3 mid_point = a_start + direction * (0.5f * (piece_start + piece_end));
+
+		// Squared distance along the piece is a * t^2 + b * t + c
+		float a = 0.0f;
+		float b = 0.0f;
+		float c = 0.0f;
+		for (int axis = 0; axis < 3; ++axis) {
+			float bound = 0.0f;
+			if (mid_point[axis] < a_box.min()[axis]) {
+				bound = a_box.min()[axis];
+			} else if (mid_point[axis] > a_box.max()[axis]) {
+				bound = a_box.max()[axis];
+			} else {
+				continue;
+			}
+			const float offset = a_start[axis] - bound;
+			a += direction[axis] * direction[axis];
+			b += 2.0f * offset * direction[axis];
+			c += offset * offset;
+		}
+		const float parameter = a > 0.0f ? clamp(-b / (2.0f * a), piece_start, piece_end) : piece_start;
+		min_squared_distance = std::min(min_squared_distance, (a * parameter + b) * parameter + c);
+	}
+	return std::max(min_squared_distance, 0.0f);
 }
 
 /**
@@ -0,0 +1,269 @@
+/*
+ * Author: Pratik Mankawde
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/geometry/index/rtree.hpp>
+
+#include <data/cache.h>
+#include <data/data.h>
+#include <data/polygon_mesh.h>
+#include <data/spacial.h>
+#include <types.h>
+
+namespace data {
+
+/**
+ * This class represents a Polygon mesh stored on disk as a set of tiles, for meshes which do not fit in memory.
+ *
+ * A tiled mesh file is written from a \ref PolygonMesh using \ref TiledPolygonMesh::write. Polygons are split
+ * spatially into tiles, each tile carrying its own vertices and topology. Only the bounds of the tiles are kept in
+ * memory, as a small r-tree. Tiles are read from disk on demand and kept in an \ref LRUCache, which evicts
+ * them once the configured memory budget is exceeded. A resident tile is a regular \ref PolygonMesh,
+ * so it builds and caches its own r-tree the first time it is queried.
+ *
+ * Only querying is out-of-core. Writing needs the whole mesh in memory, along with a few words per polygon,
+ * so files for meshes larger than memory of the machine querying them have to be written on a bigger one.
+ *
+ * Closest point queries can run on multiple threads at once. Opening a file, or changing the memory budget,
+ * must not happen while queries are running.
+ *
+ * File layout (native byte order):
+ * - FileHeader
+ * - FileHeader::tile_count x TileRecord
+ * - for each tile: vertex positions (3 floats each), global vertex indices (uint64),
+ * 	 local topology (3 uint64 each), global polygon indices (uint64)
+ */
+class TiledPolygonMesh : public Data, public std::enable_shared_from_this<TiledPolygonMesh> {
+	public:
+
+		virtual ~TiledPolygonMesh();
+
+		/**
+		 * Default memory budget for resident tiles, 256MB
+		 */
+		static const std::size_t DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+
+		/**
+		 * Splits a mesh into tiles and writes them to a file. a_mesh must fit in memory, see class description.
+		 * @param a_mesh Mesh to write
+		 * @param a_path Path of the file to write
+		 * @param a_max_polygons_per_tile Tiles are split until they contain at most these many polygons
+		 * @return true if file was written successfully else false.
+		 */
+		static bool write(const PolygonMesh& a_mesh, const std::string& a_path, std::size_t a_max_polygons_per_tile);
+
+		/**
+		 * Opens a tiled mesh file. Only the header and tile bounds are read here. Header and tile records are
+		 * checked against the file size, so that a truncated or foreign file is rejected here instead of on query.
+		 * @param a_path Path of the tiled mesh file
+		 * @return true if file was opened successfully else false.
+		 */
+		bool open(const std::string& a_path);
+
+		/**
+		 * Given a point in same space as mesh, this function finds its closest point on the mesh.
+		 * Tiles are visited in the order of distance of their bounds from the query point, and we stop
+		 * as soon as the next tile can not contain anything closer than what we have found.
+		 * @param a_query_point Point to query for
+		 * @param a_closest_position If not null, receives the position of the closest point
+		 * @return Spacial location of closest point. Polygon and vertex indices refer to the original mesh.
+		 * 		   Invalid location if no file is open, or if a tile which had to be visited could not be read.
+		 * 		   Tiles failing to load are not cached, next query reads them again.
+		 */
+		Location closest_point(const Vec3& a_query_point, Vec3* a_closest_position = nullptr) const;
+
+		/**
+		 * Returns the mesh of a tile, reading the tile through the tile cache if it is not resident.
+		 * Tile stays resident no longer than the cache keeps it, regardless of the mesh handed out.
+		 * @param a_tile_index index of tile
+		 * @return mesh of the tile, with indices local to the tile. nullptr if there is no such tile,
+		 * 		   or if it could not be read.
+		 */
+		std::shared_ptr<const PolygonMesh> get_tile_mesh(std::size_t a_tile_index) const;
+
+		std::size_t get_tile_count() const {
+			return m_tiles.size();
+		}
+
+		std::size_t get_polygon_count() const {
+			return m_polygon_count;
+		}
+
+		std::size_t get_vertex_count() const {
+			return m_vertex_count;
+		}
+
+		/**
+		 * Updates memory budget for resident tiles, evicting tiles if required.
+		 * @param a_memory_budget Max. no. of bytes resident tiles may hold
+		 */
+		void set_memory_budget(std::size_t a_memory_budget) {
+			m_tile_cache->set_memory_budget(a_memory_budget);
+		}
+
+		/**
+		 * @return Hit, miss and eviction counts of tile cache
+		 */
+		CacheStatistics get_cache_statistics() const {
+			return m_tile_cache->get_statistics();
+		}
+
+		/**
+		 * Creates a shared pointer for this, required for enable_shared_from_this
+		 * to work properly.
+		 * @return shared_ptr of TiledPolygonMesh type
+		 */
+		static std::shared_ptr<TiledPolygonMesh> create() {
+			return std::shared_ptr<TiledPolygonMesh>(new TiledPolygonMesh());
+		}
+
+	private:
+
+		TiledPolygonMesh();
+
+		/**
+		 * Header at the start of a tiled mesh file
+		 */
+		struct FileHeader {
+				char magic[4];
+				std::uint32_t version;
+				std::uint64_t tile_count;
+				std::uint64_t vertex_count;
+				std::uint64_t polygon_count;
+		};
+
+		/**
+		 * Bounds and location of a tile inside the tiled mesh file
+		 */
+		struct TileRecord {
+				float bounds_min[3];
+				float bounds_max[3];
+				std::uint64_t offset;
+				std::uint64_t vertex_count;
+				std::uint64_t polygon_count;
+		};
+
+		/**
+		 * Pair of tile bounds and tile index, stored in r-tree
+		 */
+		using TileIndexPair = std::pair<BoundingVolume, std::size_t>;
+
+		/**
+		 * Cache data representing a resident tile. compute() reads the tile from disk.
+		 * Tiles live in the tile cache of the mesh they belong to, so they refer back to it with a plain pointer.
+		 * Holding a shared_ptr, as \ref CacheData does, would keep the mesh alive forever.
+		 */
+		class TileCacheData : public CacheData {
+			public:
+				TileCacheData(std::shared_ptr<const Data> a_data, std::size_t a_tile_index)
+						: 	CacheData(nullptr),
+							m_tiled_mesh(dynamic_cast<const TiledPolygonMesh*>(a_data.get())),
+							m_tile_index(a_tile_index),
+							m_is_computed(false),
+							m_index_memory_usage(0) {
+				}
+
+				/**
+				 * Reads the tile from disk and builds its mesh. Tile is checked to refer only to its own vertices,
+				 * and to vertices and polygons which exist in the original mesh. Spacial index of the mesh is built
+				 * right away, as tiles are only read to be queried, so that its memory is accounted for.
+				 */
+				void compute() override;
+
+				/**
+				 * @return false if tile could not be read, or was corrupt
+				 */
+				bool is_computed() const override {
+					return m_is_computed;
+				}
+
+				/**
+				 * Memory held by tile geometry, index mappings and spacial index of the mesh
+				 */
+				std::size_t get_memory_usage() const override;
+
+				const std::shared_ptr<PolygonMesh>& get_mesh() const {
+					return m_mesh;
+				}
+
+				/**
+				 * Maps tile local location to the location in original mesh
+				 * @param a_location location on tile mesh
+				 * @return location on original mesh
+				 */
+				Location to_global(const Location& a_location) const;
+
+			private:
+				/**
+				 * Mesh the tile belongs to
+				 */
+				const TiledPolygonMesh* m_tiled_mesh;
+
+				std::size_t m_tile_index;
+
+				bool m_is_computed;
+
+				/**
+				 * Tile geometry
+				 */
+				std::shared_ptr<PolygonMesh> m_mesh;
+
+				/**
+				 * Index of each tile vertex in original mesh
+				 */
+				std::vector<std::uint64_t> m_vertex_ids;
+
+				/**
+				 * Index of each tile polygon in original mesh
+				 */
+				std::vector<std::uint64_t> m_polygon_ids;
+
+				/**
+				 * Memory held by spacial index of \ref m_mesh
+				 */
+				std::size_t m_index_memory_usage;
+		};
+
+		/**
+		 * Reads bytes from file at given offset.
+		 * @return true if all the bytes were read
+		 */
+		bool read_at(void* a_buffer, std::size_t a_size, std::uint64_t a_offset) const;
+
+		/**
+		 * Closes the file if it is open and forgets about its tiles
+		 */
+		void close();
+
+		/**
+		 * File descriptor of opened tiled mesh file
+		 */
+		int m_file;
+
+		std::size_t m_vertex_count;
+
+		std::size_t m_polygon_count;
+
+		/**
+		 * Tile records as read from the file
+		 */
+		std::vector<TileRecord> m_tiles;
+
+		/**
+		 * In-memory index over tile bounds
+		 */
+		std::unique_ptr<boost::geometry::index::rtree<TileIndexPair, boost::geometry::index::quadratic<16>>> m_tile_tree;
+
+		/**
+		 * Resident tiles. Mutable for the same reason as \ref PolygonMesh's cache.
+		 */
+		mutable std::unique_ptr<LRUCache<std::size_t, TileCacheData>> m_tile_cache;
+};
+
+} /* namespace data */
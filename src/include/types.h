@@ -13,6 +13,11 @@
 // They can be treated as geometric point or geometric vector or just a collection of 3 values
 // depending on the requirement
 
+/**
+ * Vector of 2 floats
+ */
+using Vec2 = Eigen::Vector2f;
+
 /**
  * Vector of 3 floats
  */
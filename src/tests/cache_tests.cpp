@@ -0,0 +1,90 @@
+/*
+ * Author: Pratik Mankawde
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include <data/cache.h>
+
+using namespace data;
+
+namespace {
+
+// No. of TrackedCacheData alive, and no. of them freed on a reader thread
+std::atomic<std::size_t> live_count(0);
+std::atomic<std::size_t> freed_by_reader_count(0);
+thread_local bool is_reader_thread = false;
+
+/**
+ * Data tests change by hand
+ */
+class EditableData : public Data {
+	public:
+		void edit() {
+			increment_version();
+		}
+};
+
+/**
+ * Cache data keeping track of where it gets freed
+ */
+class TrackedCacheData : public CacheData {
+	public:
+		TrackedCacheData(std::shared_ptr<const Data> a_data)
+				: 	CacheData(a_data) {
+			++live_count;
+		}
+
+		~TrackedCacheData() {
+			--live_count;
+			if (is_reader_thread) {
+				++freed_by_reader_count;
+			}
+		}
+
+		void compute() override {
+		}
+};
+
+TEST(SnapshotCacheTests, ReadersNeverFreeReplacedData) {
+	live_count = 0;
+	freed_by_reader_count = 0;
+	const std::shared_ptr<EditableData> data = std::make_shared<EditableData>();
+	{
+		SnapshotCache<TrackedCacheData> cache;
+		cache.get_cached_data(data);
+
+		std::atomic<bool> is_done(false);
+		std::thread reader([&]() {
+			is_reader_thread = true;
+			while (!is_done) {
+				// Snapshot is replaced while we hold it, most of the time
+				const std::shared_ptr<const TrackedCacheData> snapshot = cache.get_snapshot();
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+		});
+		for (int rebuild = 0; rebuild < 64; ++rebuild) {
+			data->edit();
+			cache.rebuild_async(data);
+			// Rebuilds might only run when waited for, if there are no worker threads
+			cache.wait();
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		is_done = true;
+		reader.join();
+		ASSERT_EQ(freed_by_reader_count, 0u);
+
+		// Nobody holds a snapshot anymore, only the data up to date is left
+		data->edit();
+		cache.rebuild_async(data);
+		cache.wait();
+		ASSERT_EQ(cache.get_snapshot()->get_data_version(), data->get_version());
+		ASSERT_EQ(live_count, 1u);
+	}
+	ASSERT_EQ(live_count, 0u);
+}
+
+}
@@ -0,0 +1,77 @@
+/*
+ * Author: Pratik Mankawde
+ */
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include <data/polygon_mesh.h>
+#include <types.h>
+
+namespace test {
+
+/**
+ * Vertices of a grid of a_grid_size x a_grid_size unit quads on XY plane, rising and falling in waves,
+ * so that many bounding volumes are close to each other.
+ * @param a_grid_size no. of quads along each side
+ * @return (a_grid_size + 1)^2 vertices, row by row
+ */
+inline std::vector<Vec3> make_wavy_grid_vertices(std::size_t a_grid_size) {
+	std::vector<Vec3> vertices;
+	for (std::size_t y = 0; y <= a_grid_size; ++y) {
+		for (std::size_t x = 0; x <= a_grid_size; ++x) {
+			vertices.push_back(Vec3(x, y, std::sin(x * 0.7f) * std::cos(y * 0.3f)));
+		}
+	}
+	return vertices;
+}
+
+/**
+ * Vertices of a flat grid of a_grid_size x a_grid_size unit quads, parallel to XY plane.
+ * @param a_grid_size no. of quads along each side
+ * @param a_height Z of all the vertices
+ * @return (a_grid_size + 1)^2 vertices, row by row
+ */
+inline std::vector<Vec3> make_flat_grid_vertices(std::size_t a_grid_size, float a_height) {
+	std::vector<Vec3> vertices;
+	for (std::size_t y = 0; y <= a_grid_size; ++y) {
+		for (std::size_t x = 0; x <= a_grid_size; ++x) {
+			vertices.push_back(Vec3(x, y, a_height));
+		}
+	}
+	return vertices;
+}
+
+/**
+ * Topology of a grid made by \ref make_wavy_grid_vertices or \ref make_flat_grid_vertices
+ * @param a_grid_size no. of quads along each side
+ * @return two triangles per quad, row by row
+ */
+inline std::vector<data::PolygonMesh::Polygon> make_grid_topology(std::size_t a_grid_size) {
+	std::vector<data::PolygonMesh::Polygon> topology;
+	for (std::size_t y = 0; y < a_grid_size; ++y) {
+		for (std::size_t x = 0; x < a_grid_size; ++x) {
+			const std::size_t corner = y * (a_grid_size + 1) + x;
+			topology.push_back(data::PolygonMesh::Polygon(corner, corner + 1, corner + a_grid_size + 2));
+			topology.push_back(data::PolygonMesh::Polygon(corner, corner + a_grid_size + 2, corner + a_grid_size + 1));
+		}
+	}
+	return topology;
+}
+
+/**
+ * Query points scattered over, under and beside a 32x32 grid
+ * @param a_count no. of points
+ * @param a_spacing distance between points along X
+ * @return query points
+ */
+inline std::vector<Vec3> make_query_points(std::size_t a_count, float a_spacing) {
+	std::vector<Vec3> queries;
+	for (std::size_t index = 0; index < a_count; ++index) {
+		queries.push_back(Vec3(index * a_spacing, 16.0f + std::sin(index) * 20.0f, (index % 7) - 3.0f));
+	}
+	return queries;
+}
+
+} /* namespace test */
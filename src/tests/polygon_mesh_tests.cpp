@@ -2,11 +2,16 @@
  * Author: Pratik Mankawde
  */
 
+#include <atomic>
+#include <random>
+#include <thread>
 #include <gtest/gtest.h>
 
 #include <data/polygon_mesh.h>
 #include <types.h>
 
+#include "grid_mesh.h"
+
 using namespace data;
 
 namespace {
@@ -15,6 +20,8 @@ class PolygonMeshTests : public ::testing::Test {
 	protected:
 		virtual void SetUp() override {
 			pm = PolygonMesh::create();
+			// Meshes of these tests are small enough to be scanned, tests of the scan turn it on themselves
+			pm->set_brute_force_threshold(0);
 			const std::vector<Vec3> vertices = { Vec3(0.0f, 0.0f, 0.0f),
 													Vec3(1.0f, 0.0f, 0.0f),
 													Vec3(1.0f, 1.0f, 0.0f),
@@ -49,4 +56,456 @@ TEST_F(PolygonMeshTests, ClosestPointOnTheTopEdge) {
 	ASSERT_EQ(pos, Vec3(0.0f, 1.0f, 0.0f));
 }
 
+TEST_F(PolygonMeshTests, RebuildingMeshInvalidatesSpacialIndex) {
+	pm->closest_point(Vec3(0.5f, 0.5f, 0.5f));
+	ASSERT_TRUE(pm->is_spacial_index_valid());
+	const std::vector<Vec3> vertices = { Vec3(0.0f, 0.0f, 5.0f),
+											Vec3(1.0f, 0.0f, 5.0f),
+											Vec3(1.0f, 1.0f, 5.0f) };
+	pm->build_mesh(vertices, { PolygonMesh::Polygon(0, 1, 2) });
+	ASSERT_FALSE(pm->is_spacial_index_valid());
+	const Location& loc = pm->closest_point(Vec3(1.0f, 1.0f, 6.0f));
+	const Vec3 pos = pm->get_spacial_position(loc);
+	ASSERT_EQ(pos, Vec3(1.0f, 1.0f, 5.0f));
+}
+
+TEST_F(PolygonMeshTests, AddPolygonsUpdatesSpacialIndex) {
+	pm->set_rebuild_ratio(1.0f);
+	pm->closest_point(Vec3(0.5f, 0.5f, 0.5f));
+	// A triangle floating above the square, sharing the vertex 2
+	ASSERT_TRUE(pm->add_polygons({ Vec3(0.0f, 1.0f, 1.0f), Vec3(1.0f, 0.0f, 1.0f) },
+									{ PolygonMesh::Polygon(4, 5, 2) }));
+	ASSERT_EQ(pm->get_polygon_count(), 3u);
+	ASSERT_TRUE(pm->is_spacial_index_valid());
+	const Location& loc = pm->closest_point(Vec3(0.5f, 0.5f, 2.0f));
+	ASSERT_EQ(loc.polygon_index, 2u);
+	// Polygons referring to non existent vertices are rejected
+	ASSERT_FALSE(pm->add_polygons({}, { PolygonMesh::Polygon(0, 1, 6) }));
+	ASSERT_EQ(pm->get_polygon_count(), 3u);
+}
+
+TEST_F(PolygonMeshTests, RemovePolygonsUpdatesSpacialIndex) {
+	pm->set_rebuild_ratio(2.0f);
+	pm->closest_point(Vec3(0.5f, 0.5f, 0.5f));
+	ASSERT_TRUE(pm->remove_polygons({ 0 }));
+	ASSERT_EQ(pm->get_polygon_count(), 1u);
+	ASSERT_TRUE(pm->is_spacial_index_valid());
+	// Only the upper left triangle (0, 2, 3) is left, now at index 0
+	const Location& loc = pm->closest_point(Vec3(1.0f, 0.0f, 0.0f));
+	const Vec3 pos = pm->get_spacial_position(loc);
+	ASSERT_EQ(loc.polygon_index, 0u);
+	ASSERT_TRUE(pos.isApprox(Vec3(0.5f, 0.5f, 0.0f)));
+	ASSERT_FALSE(pm->remove_polygons({ 1 }));
+}
+
+TEST_F(PolygonMeshTests, TooManyEditsRebuildSpacialIndex) {
+	pm->closest_point(Vec3(0.5f, 0.5f, 0.5f));
+	// Default ratio allows no incremental edit for a mesh this small
+	ASSERT_TRUE(pm->add_polygons({}, { PolygonMesh::Polygon(1, 2, 3) }));
+	ASSERT_FALSE(pm->is_spacial_index_valid());
+	pm->closest_point(Vec3(0.5f, 0.5f, 0.5f));
+	ASSERT_TRUE(pm->is_spacial_index_valid());
+}
+
+TEST_F(PolygonMeshTests, ExactQueryHasNoError) {
+	ErrorBound bound;
+	const Location& loc = pm->closest_point(Vec3(3.5f, 3.5f, 3.5f), EXACT_QUERY, &bound);
+	ASSERT_TRUE(loc.is_valid);
+	ASSERT_FLOAT_EQ(bound.distance, (Vec3(3.5f, 3.5f, 3.5f) - Vec3(1.0f, 1.0f, 0.0f)).norm());
+	ASSERT_EQ(bound.absolute_error(), 0.0f);
+}
+
+TEST_F(PolygonMeshTests, ExactQueryMatchesBruteForce) {
+	// Two triangles share the bounding volume of each quad, so bounding volumes tied in distance are common,
+	// including ones split between a round of candidates and the next
+	const std::size_t grid_size = 40;
+	const std::vector<Vec3> vertices = test::make_wavy_grid_vertices(grid_size);
+	const std::vector<PolygonMesh::Polygon> topology = test::make_grid_topology(grid_size);
+	ASSERT_TRUE(pm->build_mesh(vertices, topology));
+
+	// Output of mt19937 is the same everywhere, unlike that of the standard distributions
+	std::mt19937 generator(4);
+	auto random = [&](float a_min, float a_max) {
+		return a_min + (a_max - a_min) * static_cast<float>(generator() / 4294967296.0);
+	};
+	std::vector<Vec3> queries;
+	for (int index = 0; index < 2000; ++index) {
+		queries.push_back(Vec3(random(-5.0f, grid_size + 5.0f), random(-5.0f, grid_size + 5.0f), random(-4.0f, 4.0f)));
+	}
+	std::vector<ErrorBound> bounds;
+	const std::vector<Location> locations = pm->closest_points(queries, EXACT_QUERY, &bounds);
+	for (std::size_t index = 0; index < queries.size(); ++index) {
+		float expected = std::numeric_limits<float>::max();
+		for (std::size_t polygon_index = 0; polygon_index < topology.size(); ++polygon_index) {
+			const PolygonMesh::Polygon& polygon = topology[polygon_index];
+			const Vec3 barycentric_coords = get_closest_point_on_triangle(vertices[polygon[0]],
+																			vertices[polygon[1]],
+																			vertices[polygon[2]],
+																			queries[index]);
+			const Vec3 position = pm->get_spacial_position(Location { polygon, polygon_index, barycentric_coords, true });
+			expected = std::min(expected, (position - queries[index]).norm());
+		}
+		ASSERT_TRUE(locations[index].is_valid);
+		ASSERT_NEAR((pm->get_spacial_position(locations[index]) - queries[index]).norm(), expected, 1e-5f);
+		ASSERT_EQ(bounds[index].absolute_error(), 0.0f);
+	}
+}
+
+TEST_F(PolygonMeshTests, ClosestPointAtVertexRegion) {
+	// Query point is behind vertex 3 on both of its edges, for both triangles
+	const Location& loc = pm->closest_point(Vec3(-1.0f, 2.0f, 0.0f));
+	const Vec3 pos = pm->get_spacial_position(loc);
+	ASSERT_EQ(pos, Vec3(0.0f, 1.0f, 0.0f));
+}
+
+TEST_F(PolygonMeshTests, ApproximateQueryStaysWithinTolerance) {
+	const std::vector<Vec3> vertices = test::make_wavy_grid_vertices(32);
+	const std::vector<PolygonMesh::Polygon> topology = test::make_grid_topology(32);
+	ASSERT_TRUE(pm->build_mesh(vertices, topology));
+
+	const std::vector<Vec3> queries = test::make_query_points(64, 0.5f);
+	const QueryTolerance tolerance { 0.5f, 0.0f };
+	std::vector<ErrorBound> bounds;
+	const std::vector<Location> approximate = pm->closest_points(queries, tolerance, &bounds);
+	const std::vector<Location> exact = pm->closest_points(queries);
+	ASSERT_EQ(approximate.size(), queries.size());
+	for (std::size_t index = 0; index < queries.size(); ++index) {
+		const float exact_distance = (pm->get_spacial_position(exact[index]) - queries[index]).norm();
+		const float distance = (pm->get_spacial_position(approximate[index]) - queries[index]).norm();
+		ASSERT_NEAR(bounds[index].distance, distance, 1e-4f);
+		ASSERT_LE(bounds[index].lower_bound, exact_distance + 1e-4f);
+		ASSERT_LE(distance, (1.0f + tolerance.relative_epsilon) * exact_distance + 1e-4f);
+		ASSERT_LE(bounds[index].relative_error(), tolerance.relative_epsilon + 1e-4f);
+		// Batch query gives the same answer as a single one
+		ASSERT_EQ(exact[index].polygon_index, pm->closest_point(queries[index]).polygon_index);
+	}
+}
+
+TEST_F(PolygonMeshTests, AttributesMustMatchElementCount) {
+	ASSERT_FALSE(pm->add_attribute("uv", AttributeDomain::VERTEX, std::vector<Vec2>(3)));
+	ASSERT_TRUE(pm->add_attribute("uv", AttributeDomain::VERTEX, std::vector<Vec2>(4)));
+	ASSERT_TRUE(pm->add_attribute("id", AttributeDomain::FACE, std::vector<float> { 1.0f, 2.0f }));
+	ASSERT_NE(pm->get_attribute<Vec2>("uv"), nullptr);
+	ASSERT_EQ(pm->get_attribute<Vec3>("uv"), nullptr);
+
+	// Attributes follow topology edits
+	pm->add_polygons({}, { PolygonMesh::Polygon(1, 2, 3) });
+	ASSERT_EQ(pm->get_attribute("id")->get_size(), 3u);
+	pm->remove_polygons({ 0 });
+	ASSERT_EQ(pm->get_attribute<float>("id")->get_values(), std::vector<float>({ 0.0f, 2.0f }));
+}
+
+TEST_F(PolygonMeshTests, EvaluateLocationsInBatch) {
+	const std::vector<Vec2> uvs = { Vec2(0.0f, 0.0f), Vec2(1.0f, 0.0f), Vec2(1.0f, 1.0f), Vec2(0.0f, 1.0f) };
+	ASSERT_TRUE(pm->add_attribute("uv", AttributeDomain::VERTEX, uvs));
+	ASSERT_TRUE(pm->add_attribute("id", AttributeDomain::FACE, std::vector<float> { 7.0f, 9.0f }));
+
+	const std::vector<Location> locations = pm->closest_points({ Vec3(0.75f, 0.25f, 1.0f),
+																	Vec3(0.25f, 0.75f, -1.0f) });
+	std::vector<float> positions[3], normals[3], uv[2], id(2);
+	for (int component = 0; component < 3; ++component) {
+		positions[component].resize(2);
+		normals[component].resize(2);
+	}
+	uv[0].resize(2);
+	uv[1].resize(2);
+
+	EvaluationBuffers buffers;
+	buffers.positions = {{ positions[0].data(), positions[1].data(), positions[2].data() }};
+	buffers.normals = {{ normals[0].data(), normals[1].data(), normals[2].data() }};
+	buffers.attributes = { { "uv", { uv[0].data(), uv[1].data() } }, { "id", { id.data() } } };
+	ASSERT_TRUE(pm->evaluate(locations, buffers));
+
+	ASSERT_FLOAT_EQ(positions[0][0], 0.75f);
+	ASSERT_FLOAT_EQ(positions[1][0], 0.25f);
+	ASSERT_FLOAT_EQ(positions[2][1], 0.0f);
+	ASSERT_FLOAT_EQ(normals[2][0], 1.0f);
+	ASSERT_FLOAT_EQ(normals[2][1], 1.0f);
+	// UVs are the same as XY positions on this mesh
+	ASSERT_FLOAT_EQ(uv[0][1], 0.25f);
+	ASSERT_FLOAT_EQ(uv[1][1], 0.75f);
+	ASSERT_EQ(id, std::vector<float>({ 7.0f, 9.0f }));
+
+	buffers.attributes = { { "uv", { uv[0].data() } } };
+	ASSERT_FALSE(pm->evaluate(locations, buffers));
+}
+
+TEST_F(PolygonMeshTests, EvaluateSkipsNullArrays) {
+	const std::vector<Vec2> uvs = { Vec2(0.0f, 0.0f), Vec2(1.0f, 0.0f), Vec2(1.0f, 1.0f), Vec2(0.0f, 1.0f) };
+	ASSERT_TRUE(pm->add_attribute("uv", AttributeDomain::VERTEX, uvs));
+	ASSERT_TRUE(pm->add_attribute("id", AttributeDomain::FACE, std::vector<float> { 7.0f, 9.0f }));
+
+	// Enough locations for several blocks, alternating between the two triangles
+	std::vector<Vec3> queries;
+	for (int index = 0; index < 5000; ++index) {
+		queries.push_back(index % 2 == 0 ? Vec3(0.75f, 0.25f, 1.0f) : Vec3(0.25f, 0.75f, -1.0f));
+	}
+	const std::vector<Location> locations = pm->closest_points(queries);
+	std::vector<float> x(queries.size()), normal_z(queries.size()), u(queries.size()), id(queries.size());
+
+	EvaluationBuffers buffers;
+	buffers.positions = {{ x.data(), nullptr, nullptr }};
+	buffers.normals = {{ nullptr, nullptr, normal_z.data() }};
+	buffers.attributes = { { "uv", { u.data(), nullptr } }, { "id", { nullptr } } };
+	ASSERT_TRUE(pm->evaluate(locations, buffers));
+	buffers.attributes = { { "id", { id.data() } } };
+	ASSERT_TRUE(pm->evaluate(locations, buffers));
+
+	for (std::size_t index = 0; index < queries.size(); ++index) {
+		ASSERT_FLOAT_EQ(x[index], queries[index].x());
+		ASSERT_FLOAT_EQ(normal_z[index], 1.0f);
+		ASSERT_FLOAT_EQ(u[index], queries[index].x());
+		ASSERT_EQ(id[index], index % 2 == 0 ? 7.0f : 9.0f);
+	}
+}
+
+TEST_F(PolygonMeshTests, FilteredQueryOnlyConsidersMatchingPolygons) {
+	ASSERT_TRUE(pm->set_polygon_masks({ 0x1, 0x2 }));
+	// Closest point overall is on polygon 0, but it is not tagged with 0x2
+	const Location& loc = pm->closest_point(Vec3(1.0f, 0.0f, 0.0f), 0x2);
+	ASSERT_EQ(loc.polygon_index, 1u);
+	ASSERT_TRUE(pm->get_spacial_position(loc).isApprox(Vec3(0.5f, 0.5f, 0.0f)));
+	ASSERT_EQ(pm->closest_point(Vec3(1.0f, 0.0f, 0.0f), 0x3).polygon_index, 0u);
+	ASSERT_FALSE(pm->closest_point(Vec3(1.0f, 0.0f, 0.0f), 0x4).is_valid);
+	ASSERT_FALSE(pm->set_polygon_masks({ 0x1 }));
+}
+
+TEST_F(PolygonMeshTests, FilteredQueriesShareHierarchyAcrossThreads) {
+	ASSERT_TRUE(pm->build_mesh(test::make_wavy_grid_vertices(32), test::make_grid_topology(32)));
+	const std::vector<Vec3> queries = test::make_query_points(32, 1.0f);
+
+	// Threads race to build the hierarchy on their first query
+	std::vector<std::thread> threads;
+	std::atomic<size_t> failure_count(0);
+	for (int thread = 0; thread < 4; ++thread) {
+		threads.emplace_back([&]() {
+			for (const Vec3& query : queries) {
+				// Closest point may lie on an edge shared by two polygons, so we compare distances
+				const float filtered_distance = (pm->get_spacial_position(pm->closest_point(query, ALL_POLYGONS_MASK)) - query).norm();
+				if (std::abs(filtered_distance - (pm->get_spacial_position(pm->closest_point(query)) - query).norm()) > 1e-5f) {
+					++failure_count;
+				}
+			}
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	ASSERT_EQ(failure_count, 0u);
+
+	// Masks changed after the hierarchy was built are picked up
+	std::vector<PolygonMask> masks(pm->get_polygon_count(), 0x1);
+	masks[100] = 0x2;
+	ASSERT_TRUE(pm->set_polygon_masks(masks));
+	for (const Vec3& query : queries) {
+		ASSERT_EQ(pm->closest_point(query, 0x2).polygon_index, 100u);
+	}
+}
+
+TEST_F(PolygonMeshTests, FilteredQueryMatchesBruteForce) {
+	const std::size_t grid_size = 32;
+	const std::vector<Vec3> vertices = test::make_wavy_grid_vertices(grid_size);
+	const std::vector<PolygonMesh::Polygon> topology = test::make_grid_topology(grid_size);
+	std::vector<PolygonMask> masks;
+	for (std::size_t y = 0; y < grid_size; ++y) {
+		for (std::size_t x = 0; x < grid_size; ++x) {
+			// Four materials laid out in stripes, and a rare one, in the same order as grid topology
+			masks.push_back(1u << ((x / 4) % 4));
+			masks.push_back((x * 7 + y * 13) % 97 == 0 ? 0x10u : 1u << ((x / 4) % 4));
+		}
+	}
+	ASSERT_TRUE(pm->build_mesh(vertices, topology));
+	ASSERT_TRUE(pm->set_polygon_masks(masks));
+
+	const std::vector<Vec3> queries = test::make_query_points(32, 1.0f);
+	for (const PolygonMask filter : { 0x1u, 0x6u, 0x10u, ALL_POLYGONS_MASK }) {
+		const std::vector<Location> locations = pm->closest_points(queries, filter);
+		for (std::size_t index = 0; index < queries.size(); ++index) {
+			float expected = std::numeric_limits<float>::max();
+			for (std::size_t polygon_index = 0; polygon_index < topology.size(); ++polygon_index) {
+				if ((masks[polygon_index] & filter) != 0) {
+					const PolygonMesh::Polygon& polygon = topology[polygon_index];
+					const Vec3 barycentric_coords = get_closest_point_on_triangle(vertices[polygon[0]],
+																					vertices[polygon[1]],
+																					vertices[polygon[2]],
+																					queries[index]);
+					const Vec3 position = pm->get_spacial_position(Location { polygon, polygon_index, barycentric_coords, true });
+					expected = std::min(expected, (position - queries[index]).norm());
+				}
+			}
+			ASSERT_TRUE(locations[index].is_valid);
+			ASSERT_NE(masks[locations[index].polygon_index] & filter, 0u);
+			ASSERT_NEAR((pm->get_spacial_position(locations[index]) - queries[index]).norm(), expected, 1e-5f);
+		}
+	}
+}
+
+TEST_F(PolygonMeshTests, BackgroundRebuildKeepsQueriesRunning) {
+	// Grids of 64x64 quads at height 0 and 1, swapped while queries keep running
+	const std::size_t grid_size = 64;
+	const std::vector<Vec3> lower_vertices = test::make_flat_grid_vertices(grid_size, 0.0f);
+	const std::vector<Vec3> upper_vertices = test::make_flat_grid_vertices(grid_size, 1.0f);
+	const std::vector<PolygonMesh::Polygon> topology = test::make_grid_topology(grid_size);
+	ASSERT_TRUE(pm->build_mesh(lower_vertices, topology));
+	pm->set_background_rebuild(true);
+	pm->wait_for_spacial_index();
+
+	std::atomic<bool> is_done(false);
+	std::atomic<size_t> failure_count(0);
+	std::vector<std::thread> readers;
+	for (int reader = 0; reader < 2; ++reader) {
+		readers.emplace_back([&, reader]() {
+			for (size_t index = 0; !is_done; ++index) {
+				const Vec3 query((index * 7 + reader) % grid_size + 0.5f, (index * 13) % grid_size + 0.25f, 3.0f);
+				ErrorBound bound;
+				const Location location = pm->closest_point(query, EXACT_QUERY, &bound);
+				// Query sees either one of the grids, never a mix or nothing
+				if (!location.is_valid
+						|| (std::abs(bound.distance - 3.0f) > 1e-4f && std::abs(bound.distance - 2.0f) > 1e-4f)) {
+					++failure_count;
+				}
+			}
+		});
+	}
+	for (int rebuild = 0; rebuild < 8; ++rebuild) {
+		ASSERT_TRUE(pm->build_mesh(rebuild % 2 == 0 ? upper_vertices : lower_vertices, topology));
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	// Edits do not touch the published index either
+	ASSERT_TRUE(pm->remove_polygons({ 0, 1, 2, 3 }));
+	is_done = true;
+	for (std::thread& reader : readers) {
+		reader.join();
+	}
+	ASSERT_EQ(failure_count, 0u);
+
+	pm->wait_for_spacial_index();
+	ASSERT_TRUE(pm->is_spacial_index_valid());
+	ErrorBound bound;
+	pm->closest_point(Vec3(32.5f, 32.5f, 3.0f), EXACT_QUERY, &bound);
+	ASSERT_NEAR(bound.distance, 3.0f, 1e-4f);
+	// First two quads are gone
+	pm->closest_point(Vec3(0.75f, 0.25f, 0.0f), EXACT_QUERY, &bound);
+	ASSERT_NEAR(bound.distance, 0.75f, 1e-4f);
+}
+
+TEST_F(PolygonMeshTests, BackgroundQueriesOutliveShrinkingEdit) {
+	ASSERT_TRUE(pm->build_mesh(test::make_wavy_grid_vertices(32), test::make_grid_topology(32)));
+	// Index is published right away, queries do not have to wait for it
+	pm->set_background_rebuild(true);
+	const std::vector<Vec3> queries = test::make_query_points(64, 0.5f);
+	std::vector<ErrorBound> bounds;
+	std::vector<Vec3> positions;
+	const std::vector<Location> locations = pm->closest_points(queries, EXACT_QUERY, &bounds, &positions);
+	for (std::size_t index = 0; index < queries.size(); ++index) {
+		ASSERT_TRUE(locations[index].is_valid);
+		ASSERT_TRUE(positions[index].isApprox(pm->get_spacial_position(locations[index]), 1e-5f));
+	}
+
+	// Mesh shrinks to a single quad, locations found before refer to vertices which are gone
+	ASSERT_TRUE(pm->build_mesh(test::make_flat_grid_vertices(1, 0.0f), test::make_grid_topology(1)));
+	for (std::size_t index = 0; index < queries.size(); ++index) {
+		if (locations[index].vertex_indices.maxCoeff() >= 4) {
+			ASSERT_TRUE(pm->get_spacial_position(locations[index]).isZero());
+		}
+		// Positions came from the index the locations were found on
+		ASSERT_NEAR((positions[index] - queries[index]).norm(), bounds[index].distance, 1e-4f);
+	}
+
+	// Queries racing the rebuild get positions of whichever version they ran on
+	Vec3 position;
+	ErrorBound bound;
+	pm->closest_point(queries[0], EXACT_QUERY, &bound, &position);
+	ASSERT_NEAR((position - queries[0]).norm(), bound.distance, 1e-4f);
+	pm->wait_for_spacial_index();
+	const Location location = pm->closest_point(queries[0], EXACT_QUERY, &bound, &position);
+	ASSERT_TRUE(position.isApprox(pm->get_spacial_position(location), 1e-5f));
+	ASSERT_LT(location.polygon_index, 2u);
+}
+
+TEST_F(PolygonMeshTests, SegmentQueryOnSingleQuad) {
+	// Segment crossing the quad touches it
+	const SegmentLocation crossing = pm->closest_point(Capsule { Vec3(0.25f, 0.75f, -1.0f), Vec3(0.25f, 0.75f, 3.0f), 0.0f });
+	ASSERT_TRUE(crossing.location.is_valid);
+	ASSERT_NEAR(crossing.distance, 0.0f, 1e-6f);
+	ASSERT_NEAR(crossing.parameter, 0.25f, 1e-6f);
+	ASSERT_TRUE(pm->get_spacial_position(crossing.location).isApprox(Vec3(0.25f, 0.75f, 0.0f)));
+
+	// Segment passing over an edge of the quad, capsule around it overlaps the quad
+	const SegmentLocation over_edge = pm->closest_point(Capsule { Vec3(2.0f, -1.0f, 0.5f), Vec3(2.0f, 3.0f, 0.5f), 1.5f });
+	ASSERT_NEAR(over_edge.distance, std::sqrt(1.25f) - 1.5f, 1e-5f);
+	ASSERT_NEAR(pm->get_spacial_position(over_edge.location).x(), 1.0f, 1e-6f);
+}
+
+TEST_F(PolygonMeshTests, SegmentQueryMatchesBruteForce) {
+	const std::vector<Vec3> vertices = test::make_wavy_grid_vertices(32);
+	const std::vector<PolygonMesh::Polygon> topology = test::make_grid_topology(32);
+	ASSERT_TRUE(pm->build_mesh(vertices, topology));
+
+	const std::vector<Vec3> starts = test::make_query_points(32, 1.0f);
+	std::vector<Capsule> capsules;
+	for (std::size_t index = 0; index < starts.size(); ++index) {
+		const Vec3& start = starts[index];
+		capsules.push_back(Capsule { start, start + Vec3(std::cos(index) * 6.0f, 3.0f, (index % 3) - 1.0f), 0.5f });
+	}
+	const std::vector<SegmentLocation> locations = pm->closest_points(capsules);
+	for (std::size_t index = 0; index < capsules.size(); ++index) {
+		const Capsule& capsule = capsules[index];
+		float expected = std::numeric_limits<float>::max();
+		for (const PolygonMesh::Polygon& polygon : topology) {
+			float parameter = 0.0f;
+			Vec3 barycentric_coords;
+			expected = std::min(expected, std::sqrt(get_closest_points_on_segment_triangle(capsule.start,
+																							capsule.end,
+																							vertices[polygon[0]],
+																							vertices[polygon[1]],
+																							vertices[polygon[2]],
+																							parameter,
+																							barycentric_coords)));
+		}
+		// Sampling the segment densely can only find points as far or farther
+		float sampled = std::numeric_limits<float>::max();
+		for (int sample = 0; sample <= 256; ++sample) {
+			const Vec3 point = capsule.start + (capsule.end - capsule.start) * (sample / 256.0f);
+			sampled = std::min(sampled, (pm->get_spacial_position(pm->closest_point(point)) - point).norm());
+		}
+
+		const SegmentLocation& location = locations[index];
+		ASSERT_TRUE(location.location.is_valid);
+		ASSERT_NEAR(location.distance, expected - capsule.radius, 1e-5f);
+		ASSERT_LE(location.distance + capsule.radius, sampled + 1e-5f);
+		ASSERT_GE(location.distance + capsule.radius, sampled - 0.1f);
+		// Reported points are the closest ones
+		const Vec3 segment_point = capsule.start + (capsule.end - capsule.start) * location.parameter;
+		ASSERT_NEAR((pm->get_spacial_position(location.location) - segment_point).norm(), expected, 1e-4f);
+	}
+}
+
+TEST_F(PolygonMeshTests, BruteForceScanMatchesRTree) {
+	std::vector<Vec3> vertices = test::make_wavy_grid_vertices(12);
+	std::vector<PolygonMesh::Polygon> topology = test::make_grid_topology(12);
+	// Triangles of no area, a line and a point, far out
+	vertices.push_back(Vec3(20.0f, 0.0f, 0.0f));
+	vertices.push_back(Vec3(20.0f, 4.0f, 0.0f));
+	topology.push_back(PolygonMesh::Polygon(vertices.size() - 2, vertices.size() - 1, vertices.size() - 1));
+	topology.push_back(PolygonMesh::Polygon(vertices.size() - 2, vertices.size() - 2, vertices.size() - 2));
+	ASSERT_TRUE(pm->build_mesh(vertices, topology));
+	pm->set_brute_force_threshold(pm->get_polygon_count());
+
+	std::vector<Vec3> queries;
+	for (int index = 0; index < 200; ++index) {
+		queries.push_back(Vec3(std::fmod(index * 0.37f, 24.0f) - 2.0f, std::fmod(index * 0.71f, 16.0f) - 2.0f,
+								(index % 9) - 4.0f));
+	}
+	const std::vector<Location> scanned = pm->closest_points(queries);
+	pm->set_brute_force_threshold(0);
+	const std::vector<Location> searched = pm->closest_points(queries);
+	for (std::size_t index = 0; index < queries.size(); ++index) {
+		ASSERT_TRUE(scanned[index].is_valid);
+		ASSERT_NEAR((pm->get_spacial_position(scanned[index]) - queries[index]).norm(),
+					(pm->get_spacial_position(searched[index]) - queries[index]).norm(),
+					1e-4f);
+	}
+}
+
 }
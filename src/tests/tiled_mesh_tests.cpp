@@ -0,0 +1,139 @@
+/*
+ * Author: Pratik Mankawde
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <data/polygon_mesh.h>
+#include <data/tiled_mesh.h>
+#include <types.h>
+
+#include "grid_mesh.h"
+
+using namespace data;
+
+namespace {
+
+class TiledMeshTests : public ::testing::Test {
+	protected:
+		virtual void SetUp() override {
+			// A 16x16 grid of unit squares on XY plane, two triangles per square
+			const std::vector<Vec3> vertices = test::make_flat_grid_vertices(16, 0.0f);
+			const std::vector<PolygonMesh::Polygon> topology = test::make_grid_topology(16);
+			pm = PolygonMesh::create();
+			pm->build_mesh(vertices, topology);
+
+			path = ::testing::TempDir() + "tiled_mesh_tests.cptm";
+			ASSERT_TRUE(TiledPolygonMesh::write(*pm, path, 32));
+			tiled = TiledPolygonMesh::create();
+			ASSERT_TRUE(tiled->open(path));
+		}
+
+		virtual void TearDown() override {
+			std::remove(path.c_str());
+		}
+		std::shared_ptr<PolygonMesh> pm;
+		std::shared_ptr<TiledPolygonMesh> tiled;
+		std::string path;
+};
+
+TEST_F(TiledMeshTests, FileKeepsMeshSize) {
+	ASSERT_EQ(tiled->get_polygon_count(), pm->get_polygon_count());
+	ASSERT_EQ(tiled->get_vertex_count(), pm->get_vertex_count());
+	ASSERT_EQ(tiled->get_tile_count(), 16u);
+}
+
+TEST_F(TiledMeshTests, ClosestPointMatchesInMemoryMesh) {
+	const std::vector<Vec3> queries = { Vec3(0.5f, 0.5f, 0.5f), Vec3(7.25f, 3.5f, -2.0f),
+										Vec3(20.0f, 20.0f, 1.0f), Vec3(-3.0f, 8.5f, 0.0f) };
+	for (const Vec3& query : queries) {
+		Vec3 tiled_position;
+		const Location tiled_location = tiled->closest_point(query, &tiled_position);
+		ASSERT_TRUE(tiled_location.is_valid);
+		const Vec3 position = pm->get_spacial_position(pm->closest_point(query));
+		ASSERT_TRUE(tiled_position.isApprox(position));
+		// Location is in terms of original mesh, so it can be evaluated on it
+		ASSERT_TRUE(pm->get_spacial_position(tiled_location).isApprox(position));
+	}
+}
+
+TEST_F(TiledMeshTests, TilesAreEvictedUnderMemoryBudget) {
+	tiled->set_memory_budget(1);
+	tiled->closest_point(Vec3(0.5f, 0.5f, 1.0f));
+	tiled->closest_point(Vec3(15.5f, 15.5f, 1.0f));
+	tiled->closest_point(Vec3(0.5f, 0.5f, 1.0f));
+	const CacheStatistics& statistics = tiled->get_cache_statistics();
+	ASSERT_EQ(statistics.hits, 0u);
+	ASSERT_EQ(statistics.misses, 3u);
+	ASSERT_EQ(statistics.evictions, 2u);
+
+	tiled->set_memory_budget(TiledPolygonMesh::DEFAULT_MEMORY_BUDGET);
+	tiled->closest_point(Vec3(0.5f, 0.5f, 1.0f));
+	ASSERT_EQ(tiled->get_cache_statistics().hits, 1u);
+}
+
+TEST_F(TiledMeshTests, EvictedTileMeshIsFreed) {
+	tiled->set_memory_budget(1);
+	std::shared_ptr<const PolygonMesh> tile_mesh = tiled->get_tile_mesh(0);
+	ASSERT_NE(tile_mesh, nullptr);
+	ASSERT_TRUE(tile_mesh->closest_point(Vec3(0.5f, 0.5f, 1.0f)).is_valid);
+	std::weak_ptr<const PolygonMesh> weak_tile_mesh = tile_mesh;
+	tile_mesh.reset();
+	// Tile is resident until another one takes its place
+	ASSERT_FALSE(weak_tile_mesh.expired());
+	ASSERT_NE(tiled->get_tile_mesh(1), nullptr);
+	ASSERT_EQ(tiled->get_cache_statistics().evictions, 1u);
+	ASSERT_TRUE(weak_tile_mesh.expired());
+	ASSERT_EQ(tiled->get_tile_mesh(tiled->get_tile_count()), nullptr);
+}
+
+TEST_F(TiledMeshTests, MeshIsFreedAfterQuery) {
+	// Tiles in the cache must not keep the mesh, and its file, alive
+	std::weak_ptr<TiledPolygonMesh> weak_tiled = tiled;
+	ASSERT_TRUE(tiled->closest_point(Vec3(0.5f, 0.5f, 1.0f)).is_valid);
+	tiled.reset();
+	ASSERT_TRUE(weak_tiled.expired());
+}
+
+TEST_F(TiledMeshTests, TruncatedFileIsRejected) {
+	tiled.reset();
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	const std::streamoff file_size = file.tellg();
+	file.close();
+	ASSERT_EQ(::truncate(path.c_str(), file_size - 1), 0);
+	ASSERT_FALSE(TiledPolygonMesh::create()->open(path));
+}
+
+TEST_F(TiledMeshTests, CorruptTileIsReported) {
+	tiled.reset();
+	{
+		// Overwrite the end of the file, where global polygon indices of the last tile are
+		std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+		file.seekp(-8, std::ios::end);
+		const std::vector<char> garbage(8, '\xff');
+		file.write(garbage.data(), garbage.size());
+	}
+	tiled = TiledPolygonMesh::create();
+	ASSERT_TRUE(tiled->open(path));
+
+	// Only the tile under the query point is read, we look for the corrupt one
+	Vec3 query = Vec3::Zero();
+	bool is_found = false;
+	for (std::size_t y = 0; y < 16 && !is_found; ++y) {
+		for (std::size_t x = 0; x < 16 && !is_found; ++x) {
+			query = Vec3(x + 0.5f, y + 0.5f, 1.0f);
+			is_found = !tiled->closest_point(query).is_valid;
+		}
+	}
+	ASSERT_TRUE(is_found);
+	// Failed tile is not cached, it is read again
+	const std::size_t misses = tiled->get_cache_statistics().misses;
+	ASSERT_FALSE(tiled->closest_point(query).is_valid);
+	ASSERT_EQ(tiled->get_cache_statistics().misses, misses + 1);
+}
+
+}